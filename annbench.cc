@@ -0,0 +1,220 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <sys/time.h>
+#include <unistd.h>
+#include "recNN.h"
+
+using namespace std;
+
+//Measure the recall of the approximate search of the symbol classifier.
+//Every f-th sample of the database is held out as a query and the rest
+//are the prototypes. For every beam width ef it reports the fraction of
+//the classes of the exact n-best list found, how often the best class is
+//the exact one, the symbol accuracy and the time per query
+
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-k nbest] [-f fold] [-m links] [-c efc] [-p dims] database types [ef ...]\n", prog);
+  fprintf(stderr, "  -k nbest  Length of the n-best lists (default: 10)\n");
+  fprintf(stderr, "  -f fold   Every fold-th sample is a query (default: 5)\n");
+  fprintf(stderr, "  -m links  Links per prototype of the graph (default: 16)\n");
+  fprintf(stderr, "  -c efc    Beam width used to build the graph (default: 100)\n");
+  fprintf(stderr, "  -p dims   Screen the exact search with the projection on 'dims'\n");
+  fprintf(stderr, "            principal components (default: 0, disabled)\n");
+}
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+//Classify all the queries, returning the classes of the n-best lists in
+//'res' and the number of them whose best class is the right one
+int run(recNN *rec, vector<int *> &qv, vector<string> &qc, int nbest,
+	vector<int> *res, double *us) {
+  int *k = new int[nbest];
+  float *p = new float[nbest];
+  int ok=0;
+
+  res->resize(qv.size()*nbest);
+
+  double t0 = now();
+  for(int i=0; i<(int)qv.size(); i++) {
+    rec->classify(qv[i], nbest, k, p);
+
+    for(int j=0; j<nbest; j++)
+      (*res)[i*nbest + j] = k[j];
+    if( k[nbest-1] >= 0 && qc[i] == rec->strClass(k[nbest-1]) )
+      ok++;
+  }
+  *us = qv.empty() ? 0 : (now()-t0)*1e6/qv.size();
+
+  delete[] k;
+  delete[] p;
+
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  int nbest=10, fold=5, M=16, efc=100, dims=0;
+  int opt;
+
+  while( (opt = getopt(argc, argv, "k:f:m:c:p:")) != -1 ) {
+    switch( opt ) {
+    case 'k': nbest = atoi(optarg); break;
+    case 'f': fold = atoi(optarg); break;
+    case 'm': M = atoi(optarg); break;
+    case 'c': efc = atoi(optarg); break;
+    case 'p': dims = atoi(optarg); break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if( argc-optind < 2 || nbest < 1 || fold < 2 ) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  FILE *bd = fopen(argv[optind], "r");
+  if( !bd ) {
+    fprintf(stderr, "Error loading symbols file '%s'\n", argv[optind]);
+    return -1;
+  }
+  FILE *tp = fopen(argv[optind+1], "r");
+  if( !tp ) {
+    fprintf(stderr, "Error loading symbols information file '%s'\n", argv[optind+1]);
+    return -1;
+  }
+
+  //Split the database: queries apart and prototypes to a temporary file
+  int N, D=225;
+  if( fscanf(bd, "%d", &N) != 1 ) {
+    fprintf(stderr, "Error reading symbols file '%s'\n", argv[optind]);
+    return -1;
+  }
+
+  vector<int *> qv;
+  vector<string> qc;
+  vector<string> protos;
+
+  for(int i=0; i<N; i++) {
+    char clase[256];
+    int *vec = new int[D];
+    string line;
+
+    if( fscanf(bd, "%255s", clase) != 1 ) {
+      fprintf(stderr, "Error reading sample %d\n", i);
+      return -1;
+    }
+    line = clase;
+    for(int j=0; j<D; j++) {
+      char num[16];
+      if( fscanf(bd, "%d", &vec[j]) != 1 ) {
+	fprintf(stderr, "Error reading sample %d\n", i);
+	return -1;
+      }
+      sprintf(num, " %d", vec[j]);
+      line += num;
+    }
+
+    if( i % fold == 0 ) {
+      qv.push_back(vec);
+      qc.push_back(clase);
+    }
+    else {
+      protos.push_back(line);
+      delete[] vec;
+    }
+  }
+  fclose(bd);
+
+  FILE *tmp = tmpfile();
+  fprintf(tmp, "%d\n", (int)protos.size());
+  for(int i=0; i<(int)protos.size(); i++)
+    fprintf(tmp, "%s\n", protos[i].c_str());
+  rewind(tmp);
+
+  recNN rec(tmp, tp);
+  fclose(tmp);
+  fclose(tp);
+  rec.setPCA(dims);
+
+  printf("%d prototypes, %d queries, %d-best, ink density %.3f (%s)\n", (int)protos.size(),
+	 (int)qv.size(), nbest, rec.inkDensity(), rec.isSparse() ? "sparse" : "dense");
+
+  vector<int> exact, ann;
+  double us;
+  int ok = run(&rec, qv, qc, nbest, &exact, &us);
+
+  printf("%8s %10s %8s %9s %9s\n", "ef", "recall", "top-1", "accuracy", "us/query");
+  printf("%8s %10.4f %8.4f %9.4f %9.1f\n", "exact", 1.0, 1.0, (double)ok/qv.size(), us);
+
+  vector<int> efs;
+  for(int i=optind+2; i<argc; i++)
+    efs.push_back(atoi(argv[i]));
+  if( efs.empty() )
+    for(int ef=10; ef<=320; ef*=2)
+      efs.push_back(ef);
+
+  for(int e=0; e<(int)efs.size(); e++) {
+    if( efs[e] < 1 )
+      continue;
+
+    double t0 = now();
+    rec.setANN(efs[e], M, efc);
+    if( e == 0 )
+      fprintf(stderr, "Graph built in %.3f s\n", now()-t0);
+
+    ok = run(&rec, qv, qc, nbest, &ann, &us);
+
+    //Recall: classes of the exact n-best list found by the approximate one
+    int found=0, total=0, top=0;
+    for(int i=0; i<(int)qv.size(); i++) {
+      int *ex = &exact[i*nbest], *ap = &ann[i*nbest];
+
+      for(int j=0; j<nbest; j++) {
+	if( ex[j] < 0 )
+	  continue;
+	total++;
+	for(int t=0; t<nbest; t++)
+	  if( ap[t] == ex[j] ) {
+	    found++;
+	    break;
+	  }
+      }
+      if( ex[nbest-1] == ap[nbest-1] )
+	top++;
+    }
+
+    printf("%8d %10.4f %8.4f %9.4f %9.1f\n", efs[e], total ? (double)found/total : 1.0,
+	   (double)top/qv.size(), (double)ok/qv.size(), us);
+  }
+
+  for(int i=0; i<(int)qv.size(); i++)
+    delete[] qv[i];
+
+  return 0;
+}
@@ -0,0 +1,83 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/time.h>
+#include "recNN.h"
+
+using namespace std;
+
+//Compile a symbol database of text and its symbol types into the binary
+//file loaded by recNN, that is mapped instead of parsed. It reports the
+//time to load the database in both formats
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+int main(int argc, char *argv[]) {
+  if( argc != 4 ) {
+    fprintf(stderr, "Usage: %s database types compiled\n", argv[0]);
+    return -1;
+  }
+
+  FILE *bd = fopen(argv[1], "r");
+  if( !bd ) {
+    fprintf(stderr, "Error loading symbols file '%s'\n", argv[1]);
+    return -1;
+  }
+  FILE *tp = fopen(argv[2], "r");
+  if( !tp ) {
+    fprintf(stderr, "Error loading symbols information file '%s'\n", argv[2]);
+    return -1;
+  }
+
+  double t0 = now();
+  recNN *rec = new recNN(bd, tp);
+  double tText = now()-t0;
+  fclose(bd);
+  fclose(tp);
+
+  FILE *fd = fopen(argv[3], "wb");
+  if( !fd || !rec->save(fd) ) {
+    fprintf(stderr, "Error writing compiled database '%s'\n", argv[3]);
+    return -1;
+  }
+  fclose(fd);
+  delete rec;
+
+  fd = fopen(argv[3], "rb");
+  if( !fd ) {
+    fprintf(stderr, "Error loading compiled database '%s'\n", argv[3]);
+    return -1;
+  }
+
+  t0 = now();
+  rec = new recNN(fd, NULL);
+  double tBin = now()-t0;
+  fclose(fd);
+
+  printf("%d classes compiled into '%s'\n", rec->getNClasses(), argv[3]);
+  printf("Loaded in %.3f s (text), %.4f s (compiled)\n", tText, tBin);
+  delete rec;
+
+  return 0;
+}
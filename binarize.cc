@@ -0,0 +1,189 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "binarize.h"
+#include "pnm.h"
+
+using namespace std;
+
+int otsuThreshold(const unsigned char *pix, int X, int Y, int stride) {
+  //Four partial histograms avoid stalls on runs of equal pixels
+  unsigned int h4[4][256];
+  memset(h4, 0, sizeof(h4));
+
+  for(int y=0; y<Y; y++) {
+    const unsigned char *row = pix + (size_t)y*stride;
+    int x=0;
+    for(; x+4 <= X; x+=4) {
+      h4[0][row[x]]++;
+      h4[1][row[x+1]]++;
+      h4[2][row[x+2]]++;
+      h4[3][row[x+3]]++;
+    }
+    for(; x<X; x++)
+      h4[0][row[x]]++;
+  }
+
+  double hist[256], total=0, sum=0;
+  for(int i=0; i<256; i++) {
+    hist[i] = (double)h4[0][i] + h4[1][i] + h4[2][i] + h4[3][i];
+    total += hist[i];
+    sum += i*hist[i];
+  }
+
+  //Maximize the variance between classes [0,t] (ink) and (t,255]
+  double wB=0, sB=0, best=0;
+  int thr=0;
+  for(int t=0; t<255; t++) {
+    wB += hist[t];
+    sB += t*hist[t];
+    double wF = total - wB;
+    if( wB == 0 || wF == 0 )
+      continue;
+
+    double d = sB/wB - (sum-sB)/wF;
+    double between = wB*wF*d*d;
+    if( between > best ) {
+      best = between;
+      thr = t+1;
+    }
+  }
+
+  return thr;
+}
+
+static inline unsigned char reverse(unsigned int b) {
+  b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+  b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+  b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+  return b;
+}
+
+//Pack a row of X pixels into bits, 1 where the pixel is below its threshold
+static void packRow(const unsigned char *row, const unsigned char *thr, int X,
+		    unsigned char *out) {
+  int x=0;
+
+#ifdef __SSE2__
+  //16 pixels at a time: p < t if max(p,t) != p
+  for(; x+16 <= X; x+=16) {
+    __m128i p = _mm_loadu_si128((const __m128i *)(row+x));
+    __m128i t = _mm_loadu_si128((const __m128i *)(thr+x));
+    int m = ~_mm_movemask_epi8( _mm_cmpeq_epi8(_mm_max_epu8(p, t), p) );
+
+    //The mask has the first pixel in the least significant bit
+    out[x>>3]     = reverse(m & 255);
+    out[(x>>3)+1] = reverse((m >> 8) & 255);
+  }
+#endif
+
+  for(; x<X; x+=8) {
+    unsigned char b=0;
+    for(int i=0; i<8 && x+i<X; i++)
+      if( row[x+i] < thr[x+i] )
+	b |= 128 >> i;
+    out[x>>3] = b;
+  }
+}
+
+//Sauvola thresholds T = m*(1 + k*(s/128 - 1)) of a row, from the mean m
+//and deviation s of the window. The integral of the window columns is
+//kept for the rows of the window only, so sums are modulo 2^32 but the
+//difference of two of them is exact for windows below 256 x 256
+static void sauvolaRow(const unsigned int *cs, const unsigned int *cq, int X,
+		       int rows, int r, float k, unsigned int *is, unsigned int *iq,
+		       unsigned char *thr) {
+  is[0] = iq[0] = 0;
+  for(int x=0; x<X; x++) {
+    is[x+1] = is[x] + cs[x];
+    iq[x+1] = iq[x] + cq[x];
+  }
+
+  for(int x=0; x<X; x++) {
+    int x0 = max(x-r, 0), x1 = min(x+r+1, X);
+    float n = (float)(x1-x0)*rows;
+    float m = (is[x1]-is[x0]) / n;
+    float v = (iq[x1]-iq[x0]) / n - m*m;
+    float t = m * (1 + k*(sqrt(max(v, 0.0f))/128 - 1));
+
+    thr[x] = t >= 254 ? 255 : (unsigned char)t + 1;
+  }
+}
+
+unsigned char *binarize(const unsigned char *pix, int X, int Y, int stride,
+			int method, int *mstride, int win, float k) {
+  unsigned char *mask = newPixels((X+7)/8, Y, mstride);
+  unsigned char *thr = new unsigned char[X];
+
+  if( method == BIN_SAUVOLA ) {
+    int r = min(max(win, 3), 255) / 2;
+    unsigned int *cs = new unsigned int[X], *cq = new unsigned int[X];
+    unsigned int *is = new unsigned int[X+1], *iq = new unsigned int[X+1];
+
+    for(int x=0; x<X; x++)
+      cs[x] = cq[x] = 0;
+
+    //Sums of the columns of the window rows [y-r,y+r]
+    for(int y=-r; y<Y; y++) {
+      if( y+r < Y ) {
+	const unsigned char *row = pix + (size_t)(y+r)*stride;
+	for(int x=0; x<X; x++) {
+	  cs[x] += row[x];
+	  cq[x] += row[x]*row[x];
+	}
+      }
+      if( y-r-1 >= 0 ) {
+	const unsigned char *row = pix + (size_t)(y-r-1)*stride;
+	for(int x=0; x<X; x++) {
+	  cs[x] -= row[x];
+	  cq[x] -= row[x]*row[x];
+	}
+      }
+      if( y < 0 )
+	continue;
+
+      int rows = min(y+r+1, Y) - max(y-r, 0);
+      sauvolaRow(cs, cq, X, rows, r, k, is, iq, thr);
+      packRow(pix + (size_t)y*stride, thr, X, mask + (size_t)y*(*mstride));
+    }
+
+    delete[] cs;
+    delete[] cq;
+    delete[] is;
+    delete[] iq;
+  }
+  else {
+    int t = method == BIN_OTSU ? otsuThreshold(pix, X, Y, stride) : 255;
+    memset(thr, t, X);
+
+    for(int y=0; y<Y; y++)
+      packRow(pix + (size_t)y*stride, thr, X, mask + (size_t)y*(*mstride));
+  }
+
+  delete[] thr;
+
+  return mask;
+}
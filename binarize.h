@@ -0,0 +1,38 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#ifndef _BINARIZE_
+#define _BINARIZE_
+
+//Binarization methods
+#define BIN_NONE    0 //Every pixel darker than white is ink
+#define BIN_OTSU    1 //Global threshold (Otsu)
+#define BIN_SAUVOLA 2 //Local threshold from the mean and deviation (Sauvola)
+
+//Global threshold of an image of 8-bit gray levels: pixels below the
+//returned value are ink
+int otsuThreshold(const unsigned char *pix, int X, int Y, int stride);
+
+//Foreground mask of an image of 8-bit gray levels, with 1-bit pixels
+//(most significant bit first, 1 is ink) in a new pixel buffer (see
+//newPixels) whose row length is returned in 'mstride'. The local method
+//uses a window of win x win pixels and the sensitivity k
+unsigned char *binarize(const unsigned char *pix, int X, int Y, int stride,
+			int method, int *mstride, int win=31, float k=0.3);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <sys/time.h>
+#include <unistd.h>
+#include "recNN.h"
+#include "recMLP.h"
+
+using namespace std;
+
+//Compare the symbol classifiers: the nearest neighbour search (recNN)
+//and the multilayer perceptron (recMLP). Every f-th sample of the
+//database is held out as a query and the rest are the training samples
+//of both. It reports the accuracy of the best class and of the n-best
+//list, how often the best class of the perceptron is that of the
+//nearest neighbours and the time per query, alone and in a batch
+
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-k nbest] [-f fold] [-h hidden] [-e epochs] [-l rate] [-m model] database types\n", prog);
+  fprintf(stderr, "  -k nbest   Length of the n-best lists (default: 5)\n");
+  fprintf(stderr, "  -f fold    Every fold-th sample is a query (default: 5)\n");
+  fprintf(stderr, "  -h hidden  Hidden units of the perceptron (default: 64)\n");
+  fprintf(stderr, "  -e epochs  Training epochs of the perceptron (default: 30)\n");
+  fprintf(stderr, "  -l rate    Learning rate of the perceptron (default: 0.01)\n");
+  fprintf(stderr, "  -m model   Perceptron trained with mlptrain instead (it may\n");
+  fprintf(stderr, "             have seen the queries)\n");
+}
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+//Classify all the queries one by one and at once. The n-best lists
+//are returned in 'res', the time per query in us and ub
+void run(SymClassifier *rec, vector<int> &qv, int M, int nbest, vector<int> *res,
+	 double *us, double *ub) {
+  vector<float> p((size_t)M*nbest);
+  int D=225;
+
+  res->resize((size_t)M*nbest);
+
+  double t0 = now();
+  for(int m=0; m<M; m++)
+    rec->classify(&qv[(size_t)m*D], nbest, &(*res)[(size_t)m*nbest], &p[(size_t)m*nbest]);
+  *us = M ? (now()-t0)*1e6/M : 0;
+
+  t0 = now();
+  rec->classifyBatch(&qv[0], M, nbest, &(*res)[0], &p[0]);
+  *ub = M ? (now()-t0)*1e6/M : 0;
+}
+
+//Queries whose class is the best one and is in the n-best list
+void accuracy(SymClassifier *rec, vector<int> &res, vector<string> &qc, int nbest,
+	      double *top, double *inList) {
+  int M = qc.size(), t=0, l=0;
+
+  for(int m=0; m<M; m++) {
+    int *k = &res[(size_t)m*nbest];
+    if( k[nbest-1] >= 0 && qc[m] == rec->strClass(k[nbest-1]) )
+      t++;
+    for(int i=0; i<nbest; i++)
+      if( k[i] >= 0 && qc[m] == rec->strClass(k[i]) ) {
+	l++;
+	break;
+      }
+  }
+
+  *top = M ? (double)t/M : 0;
+  *inList = M ? (double)l/M : 0;
+}
+
+int main(int argc, char *argv[]) {
+  int nbest=5, fold=5, H=64, epochs=30;
+  float rate=0.01;
+  char *model=NULL;
+  int opt;
+
+  while( (opt = getopt(argc, argv, "k:f:h:e:l:m:")) != -1 ) {
+    switch( opt ) {
+    case 'k': nbest = atoi(optarg); break;
+    case 'f': fold = atoi(optarg); break;
+    case 'h': H = atoi(optarg); break;
+    case 'e': epochs = atoi(optarg); break;
+    case 'l': rate = atof(optarg); break;
+    case 'm': model = optarg; break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if( argc-optind != 2 || nbest < 1 || fold < 2 || H < 0 || epochs < 1 ) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  FILE *bd = fopen(argv[optind], "r");
+  if( !bd ) {
+    fprintf(stderr, "Error loading symbols file '%s'\n", argv[optind]);
+    return -1;
+  }
+
+  //Split the database: queries apart and training samples to a temporary file
+  int N, D=225;
+  if( fscanf(bd, "%d", &N) != 1 ) {
+    fprintf(stderr, "Error reading symbols file '%s'\n", argv[optind]);
+    return -1;
+  }
+
+  vector<int> qv;
+  vector<string> qc;
+  vector<string> train;
+
+  for(int i=0; i<N; i++) {
+    char clase[256];
+    vector<int> vec(D);
+    string line;
+
+    if( fscanf(bd, "%255s", clase) != 1 ) {
+      fprintf(stderr, "Error reading sample %d\n", i);
+      return -1;
+    }
+    line = clase;
+    for(int j=0; j<D; j++) {
+      char num[16];
+      if( fscanf(bd, "%d", &vec[j]) != 1 ) {
+	fprintf(stderr, "Error reading sample %d\n", i);
+	return -1;
+      }
+      sprintf(num, " %d", vec[j]);
+      line += num;
+    }
+
+    if( i % fold == 0 ) {
+      qv.insert(qv.end(), vec.begin(), vec.end());
+      qc.push_back(clase);
+    }
+    else
+      train.push_back(line);
+  }
+  fclose(bd);
+
+  FILE *tmp = tmpfile();
+  fprintf(tmp, "%d\n", (int)train.size());
+  for(int i=0; i<(int)train.size(); i++)
+    fprintf(tmp, "%s\n", train[i].c_str());
+
+  int M = qc.size();
+  printf("%d training samples, %d queries, %d-best\n", (int)train.size(), M, nbest);
+
+  //Both classifiers
+  FILE *tp = fopen(argv[optind+1], "r");
+  if( !tp ) {
+    fprintf(stderr, "Error loading symbols information file '%s'\n", argv[optind+1]);
+    return -1;
+  }
+
+  rewind(tmp);
+  double t0 = now();
+  recNN knn(tmp, tp);
+  double tknn = now()-t0;
+
+  recMLP *mlp;
+  rewind(tmp);
+  rewind(tp);
+  t0 = now();
+  if( model ) {
+    FILE *fd = fopen(model, "r");
+    if( !fd ) {
+      fprintf(stderr, "Error loading model file '%s'\n", model);
+      return -1;
+    }
+    mlp = new recMLP(fd, tp);
+    fclose(fd);
+  }
+  else
+    mlp = new recMLP(tmp, tp, H, epochs, rate);
+  double tmlp = now()-t0;
+
+  fclose(tmp);
+  fclose(tp);
+
+  vector<int> rk, rm;
+  double top, inList, us, ub;
+
+  printf("%-12s %9s %9s %9s %9s %9s %9s\n", "classifier", "top-1", "in-list", "same-top",
+	 "us/query", "us/batch", "load (s)");
+
+  run(&knn, qv, M, nbest, &rk, &us, &ub);
+  accuracy(&knn, rk, qc, nbest, &top, &inList);
+  printf("%-12s %9.4f %9.4f %9.4f %9.1f %9.1f %9.2f\n", "kNN", top, inList, 1.0, us, ub, tknn);
+
+  run(mlp, qv, M, nbest, &rm, &us, &ub);
+  accuracy(mlp, rm, qc, nbest, &top, &inList);
+
+  //The classes of the perceptron are numbered in the same order
+  int same=0;
+  for(int m=0; m<M; m++)
+    if( rm[(size_t)m*nbest + nbest-1] == rk[(size_t)m*nbest + nbest-1] )
+      same++;
+
+  char name[32];
+  sprintf(name, "MLP (%d)", H);
+  printf("%-12s %9.4f %9.4f %9.4f %9.1f %9.1f %9.2f\n", model ? "MLP (model)" : name, top,
+	 inList, M ? (double)same/M : 0, us, ub, tmlp);
+
+  delete mlp;
+
+  return 0;
+}
@@ -0,0 +1,181 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include <cstring>
+#include "clscache.h"
+
+//Magic number of the cache files
+#define CACHE_MAGIC "PMEC1"
+
+unsigned int hashBytes(const void *data, size_t n, unsigned int h) {
+  const unsigned char *b = (const unsigned char *)data;
+
+  for(size_t i=0; i<n; i++) {
+    h ^= b[i];
+    h *= 16777619u;
+  }
+
+  return h;
+}
+
+ClassCache::ClassCache(int size, int D) {
+  this->size = size;
+  this->D = D;
+  pthread_mutex_init(&lock, NULL);
+}
+
+ClassCache::~ClassCache() {
+  pthread_mutex_destroy(&lock);
+}
+
+//Put an entry first, replacing the one with the same key (a collision
+//or a shorter list) and dropping the last one if the cache is full
+void ClassCache::add(Entry &e) {
+  map<unsigned int, list<Entry>::iterator>::iterator it = index.find(e.key);
+  if( it != index.end() )
+    lru.erase(it->second);
+  else if( (int)lru.size() >= size ) {
+    index.erase(lru.back().key);
+    lru.pop_back();
+  }
+
+  lru.push_front(Entry());
+  lru.front().key = e.key;
+  lru.front().vec.swap(e.vec);
+  lru.front().k.swap(e.k);
+  lru.front().p.swap(e.p);
+  index[e.key] = lru.begin();
+}
+
+//The n-best list of the vector v, if it is cached with at least nbest
+//classes (the best ones of a longer list are the shorter list)
+bool ClassCache::lookup(const unsigned char *v, int nbest, int *k, float *p) {
+  unsigned int key = hashBytes(v, D);
+  bool found = false;
+
+  pthread_mutex_lock(&lock);
+
+  map<unsigned int, list<Entry>::iterator>::iterator it = index.find(key);
+  if( it != index.end() ) {
+    Entry &e = *it->second;
+    int n = e.k.size();
+
+    if( n >= nbest && !memcmp(&e.vec[0], v, D) ) {
+      for(int i=0; i<nbest; i++) {
+	k[i] = e.k[n-nbest+i];
+	p[i] = e.p[n-nbest+i];
+      }
+      lru.splice(lru.begin(), lru, it->second);
+      found = true;
+    }
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  return found;
+}
+
+void ClassCache::insert(const unsigned char *v, int nbest, const int *k, const float *p) {
+  Entry e;
+  e.key = hashBytes(v, D);
+  e.vec.assign(v, v+D);
+  e.k.assign(k, k+nbest);
+  e.p.assign(p, p+nbest);
+
+  pthread_mutex_lock(&lock);
+  add(e);
+  pthread_mutex_unlock(&lock);
+}
+
+int ClassCache::entries() {
+  pthread_mutex_lock(&lock);
+  int n = lru.size();
+  pthread_mutex_unlock(&lock);
+
+  return n;
+}
+
+//Binary file: magic number, D, tag and number of entries, then every
+//entry (most recently used first) as D bytes, n and n classes and
+//distances. Files of another tag or dimension, or not complete, are not
+//loaded
+bool ClassCache::load(FILE *fd, unsigned int tag) {
+  char magic[sizeof(CACHE_MAGIC)];
+  unsigned int ftag;
+  int fD, n;
+
+  if( fread(magic, 1, sizeof(magic), fd) != sizeof(magic)
+      || memcmp(magic, CACHE_MAGIC, sizeof(magic))
+      || fread(&fD, sizeof(int), 1, fd) != 1 || fread(&ftag, sizeof(int), 1, fd) != 1
+      || fread(&n, sizeof(int), 1, fd) != 1 || fD != D || ftag != tag )
+    return false;
+
+  pthread_mutex_lock(&lock);
+
+  bool ok = true;
+  for(int i=0; i<n && ok; i++) {
+    Entry e;
+    int nb;
+
+    e.vec.resize(D);
+    ok = fread(&e.vec[0], 1, D, fd) == (size_t)D && fread(&nb, sizeof(int), 1, fd) == 1
+      && nb > 0 && nb <= 1<<16;
+    if( !ok )
+      break;
+
+    e.k.resize(nb);
+    e.p.resize(nb);
+    ok = fread(&e.k[0], sizeof(int), nb, fd) == (size_t)nb
+      && fread(&e.p[0], sizeof(float), nb, fd) == (size_t)nb;
+
+    //Older entries go behind the ones already loaded
+    if( ok && (int)lru.size() < size && index.find(e.key = hashBytes(&e.vec[0], D)) == index.end() ) {
+      lru.push_back(e);
+      index[e.key] = --lru.end();
+    }
+  }
+
+  if( !ok ) {
+    lru.clear();
+    index.clear();
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  return ok;
+}
+
+bool ClassCache::save(FILE *fd, unsigned int tag) {
+  pthread_mutex_lock(&lock);
+
+  int n = lru.size();
+  bool ok = fwrite(CACHE_MAGIC, 1, sizeof(CACHE_MAGIC), fd) == sizeof(CACHE_MAGIC)
+    && fwrite(&D, sizeof(int), 1, fd) == 1 && fwrite(&tag, sizeof(int), 1, fd) == 1
+    && fwrite(&n, sizeof(int), 1, fd) == 1;
+
+  for(list<Entry>::iterator it=lru.begin(); ok && it!=lru.end(); ++it) {
+    int nb = it->k.size();
+    ok = fwrite(&it->vec[0], 1, D, fd) == (size_t)D && fwrite(&nb, sizeof(int), 1, fd) == 1
+      && fwrite(&it->k[0], sizeof(int), nb, fd) == (size_t)nb
+      && fwrite(&it->p[0], sizeof(float), nb, fd) == (size_t)nb;
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  return ok;
+}
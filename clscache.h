@@ -0,0 +1,66 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#ifndef _CLSCACHE_
+#define _CLSCACHE_
+
+#include <cstdio>
+#include <list>
+#include <map>
+#include <vector>
+#include <pthread.h>
+
+using namespace std;
+
+//Hash (FNV-1a) of n bytes, continuing from h
+unsigned int hashBytes(const void *data, size_t n, unsigned int h=2166136261u);
+
+//Cache of classification results addressed by the content of the
+//normalized vectors (D bytes). Every entry keeps the n-best list of a
+//vector, classes and distances with the best last, and up to 'size' of
+//them are kept, dropping the least recently used. It can be shared by
+//several threads
+class ClassCache{
+  struct Entry{
+    unsigned int key;
+    vector<unsigned char> vec;
+    vector<int> k;
+    vector<float> p;
+  };
+
+  list<Entry> lru; //Most recently used first
+  map<unsigned int, list<Entry>::iterator> index;
+  int size, D;
+  pthread_mutex_t lock;
+
+  void add(Entry &e);
+
+public:
+  ClassCache(int size, int D);
+  ~ClassCache();
+
+  bool lookup(const unsigned char *v, int nbest, int *k, float *p);
+  void insert(const unsigned char *v, int nbest, const int *k, const float *p);
+  int entries();
+
+  //Files are tagged with the database the results come from
+  bool load(FILE *fd, unsigned int tag);
+  bool save(FILE *fd, unsigned int tag);
+};
+
+#endif
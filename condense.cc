@@ -0,0 +1,440 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <climits>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <sys/time.h>
+#include <unistd.h>
+#include "recNN.h"
+#include "distance.h"
+
+using namespace std;
+
+//Reduce a symbols database keeping the classification decisions. Every
+//f-th sample is held out to compare the condensed database against the
+//full one (accuracy, agreement of the best class and time), and then the
+//whole database is condensed and written in the same format
+
+#define DIM 225 //Sample's dimensions
+
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-m method] [-k neighbours] [-r ratio] [-f fold] [-t tolerance]\n", prog);
+  fprintf(stderr, "          database types output\n");
+  fprintf(stderr, "  -m method      cnn (Hart's condensing), wilson (editing), medoids\n");
+  fprintf(stderr, "                 (per class) or wilson+cnn (default: cnn)\n");
+  fprintf(stderr, "  -k neighbours  Neighbours of the editing (default: 3)\n");
+  fprintf(stderr, "  -r ratio       Fraction of every class kept as medoids (default: 0.5)\n");
+  fprintf(stderr, "  -f fold        Every fold-th sample is held out (default: 5)\n");
+  fprintf(stderr, "  -t tolerance   Maximum loss of accuracy allowed (default: 0.01)\n");
+}
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+//Samples of a database as rows of DP bytes (see distance.h)
+struct Database {
+  vector<string> cls;
+  vector<int> lab;
+  vector<int> val;
+  unsigned char *m;
+  int DP;
+};
+
+void readDatabase(char *path, Database *db) {
+  FILE *fd = fopen(path, "r");
+  if( !fd ) {
+    fprintf(stderr, "Error loading symbols file '%s'\n", path);
+    exit(-1);
+  }
+
+  int N;
+  if( fscanf(fd, "%d", &N) != 1 ) {
+    fprintf(stderr, "Error reading symbols file '%s'\n", path);
+    exit(-1);
+  }
+
+  map<string,int> keys;
+  db->val.resize((size_t)N*DIM);
+  for(int i=0; i<N; i++) {
+    char clase[256];
+    if( fscanf(fd, "%255s", clase) != 1 ) {
+      fprintf(stderr, "Error reading sample %d\n", i);
+      exit(-1);
+    }
+    for(int j=0; j<DIM; j++)
+      if( fscanf(fd, "%d", &db->val[(size_t)i*DIM + j]) != 1 ) {
+	fprintf(stderr, "Error reading sample %d\n", i);
+	exit(-1);
+      }
+
+    if( keys.find(clase) == keys.end() ) {
+      int k = keys.size();
+      keys[clase] = k;
+    }
+    db->cls.push_back(clase);
+    db->lab.push_back(keys[clase]);
+  }
+  fclose(fd);
+
+  db->DP = (DIM + DIST_ALIGN-1) & ~(DIST_ALIGN-1);
+  db->m = newVectors((size_t)N*db->DP);
+  for(int i=0; i<N; i++)
+    for(int j=0; j<DIM; j++) {
+      int v = db->val[(size_t)i*DIM + j];
+      db->m[(size_t)i*db->DP + j] = v < 0 ? 0 : (v > 255 ? 255 : v);
+    }
+}
+
+void writeDatabase(FILE *fd, Database *db, vector<int> &idx) {
+  fprintf(fd, "%d\n", (int)idx.size());
+  for(int i=0; i<(int)idx.size(); i++) {
+    fprintf(fd, "%s", db->cls[idx[i]].c_str());
+    for(int j=0; j<DIM; j++)
+      fprintf(fd, " %d", db->val[(size_t)idx[i]*DIM + j]);
+    fprintf(fd, "\n");
+  }
+}
+
+distFunc dist;
+
+inline int distance(Database *db, int a, int b) {
+  return dist(db->m + (size_t)a*db->DP, db->m + (size_t)b*db->DP, db->DP);
+}
+
+//Wilson's editing: drop the samples whose k nearest neighbours (among
+//the rest) vote for another class, ties solved by the nearest one
+vector<int> wilson(Database *db, vector<int> &idx, int K) {
+  vector<int> kept;
+
+  for(int a=0; a<(int)idx.size(); a++) {
+    vector< pair<int,int> > nn;
+    for(int b=0; b<(int)idx.size(); b++)
+      if( b != a )
+	nn.push_back(make_pair(distance(db, idx[a], idx[b]), b));
+
+    int k = min(K, (int)nn.size());
+    partial_sort(nn.begin(), nn.begin()+k, nn.end());
+
+    map<int,int> votes;
+    int best=-1, nbest=0;
+    for(int t=0; t<k; t++) {
+      int c = db->lab[idx[nn[t].second]];
+      if( ++votes[c] > nbest ) {
+	nbest = votes[c];
+	best = c;
+      }
+    }
+
+    if( best < 0 || best == db->lab[idx[a]] )
+      kept.push_back(idx[a]);
+  }
+
+  //Classes are never removed: if all their samples are dropped, the
+  //first one is kept
+  vector<bool> seen(db->lab.size(), false);
+  for(int i=0; i<(int)kept.size(); i++)
+    seen[db->lab[kept[i]]] = true;
+  for(int a=0; a<(int)idx.size(); a++)
+    if( !seen[db->lab[idx[a]]] ) {
+      seen[db->lab[idx[a]]] = true;
+      kept.push_back(idx[a]);
+    }
+
+  sort(kept.begin(), kept.end());
+  return kept;
+}
+
+//Hart's condensing: samples misclassified (nearest neighbour) by the
+//kept ones are added to them until a whole pass adds none
+vector<int> hart(Database *db, vector<int> &idx) {
+  vector<int> kept;
+  vector<bool> in(idx.size(), false);
+
+  if( idx.empty() )
+    return kept;
+
+  kept.push_back(idx[0]);
+  in[0] = true;
+
+  bool added=true;
+  while( added ) {
+    added = false;
+    for(int a=0; a<(int)idx.size(); a++) {
+      if( in[a] )
+	continue;
+
+      int dmin=INT_MAX, c=-1;
+      for(int b=0; b<(int)kept.size(); b++) {
+	int d = distance(db, idx[a], kept[b]);
+	if( d < dmin ) {
+	  dmin = d;
+	  c = db->lab[kept[b]];
+	}
+      }
+
+      if( c != db->lab[idx[a]] ) {
+	kept.push_back(idx[a]);
+	in[a] = true;
+	added = true;
+      }
+    }
+  }
+
+  sort(kept.begin(), kept.end());
+  return kept;
+}
+
+//Member of the cluster with the minimum sum of distances to the rest
+int medoid(Database *db, vector<int> &mem) {
+  long best=-1;
+  int med=mem[0];
+
+  for(int a=0; a<(int)mem.size(); a++) {
+    long s=0;
+    for(int b=0; b<(int)mem.size() && (best < 0 || s < best); b++)
+      s += distance(db, mem[a], mem[b]);
+    if( best < 0 || s < best ) {
+      best = s;
+      med = mem[a];
+    }
+  }
+
+  return med;
+}
+
+//Per class k-medoids, keeping round(ratio*n) samples of a class of n
+vector<int> medoids(Database *db, vector<int> &idx, float ratio) {
+  map< int, vector<int> > byClass;
+  for(int i=0; i<(int)idx.size(); i++)
+    byClass[db->lab[idx[i]]].push_back(idx[i]);
+
+  vector<int> kept;
+  for(map< int, vector<int> >::iterator it=byClass.begin(); it!=byClass.end(); it++) {
+    vector<int> &mem = it->second;
+    int K = max(1, (int)(ratio*mem.size() + 0.5));
+
+    //Initialization: the medoid of the class and then the farthest ones
+    vector<int> med(1, medoid(db, mem));
+    while( (int)med.size() < K ) {
+      int far=-1, dfar=-1;
+      for(int a=0; a<(int)mem.size(); a++) {
+	int dmin=INT_MAX;
+	for(int b=0; b<(int)med.size(); b++)
+	  dmin = min(dmin, distance(db, mem[a], med[b]));
+	if( dmin > dfar ) {
+	  dfar = dmin;
+	  far = mem[a];
+	}
+      }
+      med.push_back(far);
+    }
+
+    //Alternate the assignment to the nearest medoid and the update of them
+    for(int iter=0; iter<10 && K > 1; iter++) {
+      vector< vector<int> > clus(K);
+      for(int a=0; a<(int)mem.size(); a++) {
+	int best=0, dmin=INT_MAX;
+	for(int b=0; b<K; b++) {
+	  int d = distance(db, mem[a], med[b]);
+	  if( d < dmin ) {
+	    dmin = d;
+	    best = b;
+	  }
+	}
+	clus[best].push_back(mem[a]);
+      }
+
+      bool changed=false;
+      for(int b=0; b<K; b++)
+	if( !clus[b].empty() ) {
+	  int nm = medoid(db, clus[b]);
+	  changed |= nm != med[b];
+	  med[b] = nm;
+	}
+      if( !changed )
+	break;
+    }
+
+    kept.insert(kept.end(), med.begin(), med.end());
+  }
+
+  sort(kept.begin(), kept.end());
+  kept.erase(unique(kept.begin(), kept.end()), kept.end());
+  return kept;
+}
+
+vector<int> condense(Database *db, vector<int> &idx, char *method, int K, float ratio) {
+  if( !strcmp(method, "cnn") )
+    return hart(db, idx);
+  if( !strcmp(method, "wilson") )
+    return wilson(db, idx, K);
+  if( !strcmp(method, "medoids") )
+    return medoids(db, idx, ratio);
+
+  vector<int> edited = wilson(db, idx, K);
+  return hart(db, edited);
+}
+
+//Load the samples 'idx' as a classifier
+recNN *loadClassifier(Database *db, vector<int> &idx, char *types, double *secs) {
+  FILE *tmp = tmpfile();
+  writeDatabase(tmp, db, idx);
+  rewind(tmp);
+
+  FILE *tp = fopen(types, "r");
+  if( !tp ) {
+    fprintf(stderr, "Error loading symbols information file '%s'\n", types);
+    exit(-1);
+  }
+
+  double t0 = now();
+  recNN *rec = new recNN(tmp, tp);
+  *secs = now()-t0;
+
+  fclose(tmp);
+  fclose(tp);
+
+  return rec;
+}
+
+//Best class of every query (n-best lists as in the parser)
+vector<string> classify(recNN *rec, vector<int> &q, int M, double *us) {
+  const int NB=10;
+  vector<int> k(M*NB);
+  vector<float> p(M*NB);
+  vector<string> res(M);
+
+  double t0 = now();
+  if( M > 0 )
+    rec->classifyBatch(&q[0], M, NB, &k[0], &p[0]);
+  *us = M > 0 ? (now()-t0)*1e6/M : 0;
+
+  for(int i=0; i<M; i++)
+    res[i] = k[i*NB + NB-1] >= 0 ? rec->strClass(k[i*NB + NB-1]) : "";
+
+  return res;
+}
+
+int main(int argc, char *argv[]) {
+  char method[32] = "cnn";
+  int K=3, fold=5;
+  float ratio=0.5, tol=0.01;
+  int opt;
+
+  while( (opt = getopt(argc, argv, "m:k:r:f:t:")) != -1 ) {
+    switch( opt ) {
+    case 'm':
+      if( strcmp(optarg, "cnn") && strcmp(optarg, "wilson") &&
+	  strcmp(optarg, "medoids") && strcmp(optarg, "wilson+cnn") ) {
+	usage(argv[0]);
+	return -1;
+      }
+      strcpy(method, optarg);
+      break;
+    case 'k': K = atoi(optarg); break;
+    case 'r': ratio = atof(optarg); break;
+    case 'f': fold = atoi(optarg); break;
+    case 't': tol = atof(optarg); break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if( argc-optind != 3 || K < 1 || fold < 2 || ratio <= 0 ) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  Database db;
+  readDatabase(argv[optind], &db);
+  dist = distKernel();
+
+  int N = db.lab.size();
+  vector<int> train, test, all(N), qv;
+  for(int i=0; i<N; i++) {
+    all[i] = i;
+    if( i % fold == 0 ) {
+      test.push_back(i);
+      qv.insert(qv.end(), db.val.begin() + (size_t)i*DIM, db.val.begin() + (size_t)(i+1)*DIM);
+    }
+    else
+      train.push_back(i);
+  }
+  int M = test.size();
+
+  //Held-out evaluation
+  vector<int> small = condense(&db, train, method, K, ratio);
+
+  double lfull, lsmall, ufull, usmall;
+  recNN *full = loadClassifier(&db, train, argv[optind+1], &lfull);
+  recNN *red = loadClassifier(&db, small, argv[optind+1], &lsmall);
+  vector<string> cfull = classify(full, qv, M, &ufull);
+  vector<string> csmall = classify(red, qv, M, &usmall);
+
+  int okf=0, oks=0, agree=0;
+  for(int i=0; i<M; i++) {
+    okf += cfull[i] == db.cls[test[i]];
+    oks += csmall[i] == db.cls[test[i]];
+    agree += cfull[i] == csmall[i];
+  }
+  double af = M ? (double)okf/M : 0, as = M ? (double)oks/M : 0;
+
+  printf("Method %s, %d held-out samples\n", method, M);
+  printf("%10s %10s %10s %10s\n", "", "prototypes", "load (ms)", "us/query");
+  printf("%10s %10d %10.2f %10.1f\n", "full", (int)train.size(), lfull*1e3, ufull);
+  printf("%10s %10d %10.2f %10.1f\n", "condensed", (int)small.size(), lsmall*1e3, usmall);
+  printf("Reduction %.1f%%, speed-up %.2fx\n", 100.0*(1 - (double)small.size()/max((int)train.size(), 1)),
+	 usmall > 0 ? ufull/usmall : 0);
+  printf("Accuracy %.4f -> %.4f (%+.4f), best class agreement %.4f\n", af, as, as-af,
+	 M ? (double)agree/M : 1.0);
+
+  delete full;
+  delete red;
+
+  bool ok = af - as <= tol;
+  if( !ok )
+    fprintf(stderr, "Warning: the loss of accuracy %.4f exceeds the tolerance %.4f\n", af-as, tol);
+
+  //Condense the whole database
+  vector<int> out = condense(&db, all, method, K, ratio);
+
+  FILE *fd = fopen(argv[optind+2], "w");
+  if( !fd ) {
+    fprintf(stderr, "Error writing '%s'\n", argv[optind+2]);
+    return -1;
+  }
+  writeDatabase(fd, &db, out);
+  fclose(fd);
+
+  printf("Written %d of %d samples to '%s'\n", (int)out.size(), N, argv[optind+2]);
+
+  freeVectors(db.m);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,379 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#if defined(__GNUC__) && defined(__x86_64__)
+#define DIST_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "distance.h"
+
+using namespace std;
+
+unsigned char *newVectors(size_t n) {
+  void *v;
+
+  if( posix_memalign(&v, DIST_ALIGN, n ? n : DIST_ALIGN) ) {
+    fprintf(stderr, "Error allocating %lu bytes of vectors\n", (unsigned long)n);
+    exit(-1);
+  }
+  memset(v, 0, n);
+
+  return (unsigned char *)v;
+}
+
+void freeVectors(unsigned char *v) {
+  free(v);
+}
+
+#ifndef __SSE2__
+static int distScalar(const unsigned char *a, const unsigned char *b, int n) {
+  int d=0;
+  for(int i=0; i<n; i++) {
+    int t = a[i] - b[i];
+    d += t*t;
+  }
+  return d;
+}
+
+static int distBoundScalar(const unsigned char *a, const unsigned char *b, int n,
+			   int bound, int *len) {
+  int d=0;
+  for(int i=0; i<n; i+=DIST_ALIGN) {
+    for(int j=i; j<i+DIST_ALIGN; j++) {
+      int t = a[j] - b[j];
+      d += t*t;
+    }
+    if( d > bound ) {
+      *len = i+DIST_ALIGN;
+      return d;
+    }
+  }
+  *len = n;
+  return d;
+}
+
+static void dot4Scalar(const unsigned char *q, size_t qs, const unsigned char *p,
+		       int n, int *d) {
+  for(int t=0; t<4; t++) {
+    const unsigned char *a = q + t*qs;
+    d[t] = 0;
+    for(int i=0; i<n; i++)
+      d[t] += a[i]*p[i];
+  }
+}
+
+static float distFloatScalar(const float *a, const float *b, int n) {
+  float d=0;
+  for(int i=0; i<n; i++)
+    d += (a[i]-b[i]) * (a[i]-b[i]);
+  return d;
+}
+
+static void dot4FloatScalar(const float *q, size_t qs, const float *w, int n,
+			    float *d) {
+  for(int t=0; t<4; t++) {
+    const float *a = q + t*qs;
+    d[t] = 0;
+    for(int i=0; i<n; i++)
+      d[t] += a[i]*w[i];
+  }
+}
+#else
+//Differences of 16-bit values squared and added in pairs (madd). The sum
+//of 225 squared differences of 8-bit values fits in 32 bits
+static int distSSE2(const unsigned char *a, const unsigned char *b, int n) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+
+  for(int i=0; i<n; i+=16) {
+    __m128i va = _mm_load_si128((const __m128i *)(a+i));
+    __m128i vb = _mm_load_si128((const __m128i *)(b+i));
+    __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+    __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+  }
+
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+  return _mm_cvtsi128_si32(acc);
+}
+
+static inline __m128i sqdiff16(const unsigned char *a, const unsigned char *b) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i va = _mm_load_si128((const __m128i *)a);
+  __m128i vb = _mm_load_si128((const __m128i *)b);
+  __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+  __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+  return _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+}
+
+static int distBoundSSE2(const unsigned char *a, const unsigned char *b, int n,
+			 int bound, int *len) {
+  int d=0;
+  for(int i=0; i<n; i+=DIST_ALIGN) {
+    __m128i s = _mm_add_epi32(sqdiff16(a+i, b+i), sqdiff16(a+i+16, b+i+16));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    d += _mm_cvtsi128_si32(s);
+    if( d > bound ) {
+      *len = i+DIST_ALIGN;
+      return d;
+    }
+  }
+  *len = n;
+  return d;
+}
+
+//The prototype is widened once for the four queries
+static void dot4SSE2(const unsigned char *q, size_t qs, const unsigned char *p,
+		     int n, int *d) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc[4];
+  for(int t=0; t<4; t++)
+    acc[t] = zero;
+
+  for(int i=0; i<n; i+=16) {
+    __m128i vp = _mm_load_si128((const __m128i *)(p+i));
+    __m128i plo = _mm_unpacklo_epi8(vp, zero), phi = _mm_unpackhi_epi8(vp, zero);
+
+    for(int t=0; t<4; t++) {
+      __m128i vq = _mm_load_si128((const __m128i *)(q + t*qs + i));
+      acc[t] = _mm_add_epi32(acc[t], _mm_madd_epi16(_mm_unpacklo_epi8(vq, zero), plo));
+      acc[t] = _mm_add_epi32(acc[t], _mm_madd_epi16(_mm_unpackhi_epi8(vq, zero), phi));
+    }
+  }
+
+  for(int t=0; t<4; t++) {
+    __m128i s = _mm_add_epi32(acc[t], _mm_shuffle_epi32(acc[t], 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    d[t] = _mm_cvtsi128_si32(s);
+  }
+}
+
+static float distFloatSSE2(const float *a, const float *b, int n) {
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+
+  for(int i=0; i<n; i+=8) {
+    __m128 d0 = _mm_sub_ps(_mm_load_ps(a+i), _mm_load_ps(b+i));
+    __m128 d1 = _mm_sub_ps(_mm_load_ps(a+i+4), _mm_load_ps(b+i+4));
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+  }
+
+  float s[4];
+  _mm_storeu_ps(s, _mm_add_ps(acc0, acc1));
+  return (s[0]+s[1]) + (s[2]+s[3]);
+}
+
+//Transpose of the four accumulators added by columns: the sums of each
+static inline __m128 hsum4(__m128 a0, __m128 a1, __m128 a2, __m128 a3) {
+  _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+  return _mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(a2, a3));
+}
+
+static void dot4FloatSSE2(const float *q, size_t qs, const float *w, int n,
+			  float *d) {
+  __m128 a0 = _mm_setzero_ps(), a1 = a0, a2 = a0, a3 = a0;
+
+  for(int i=0; i<n; i+=4) {
+    __m128 vw = _mm_load_ps(w+i);
+    a0 = _mm_add_ps(a0, _mm_mul_ps(vw, _mm_load_ps(q+i)));
+    a1 = _mm_add_ps(a1, _mm_mul_ps(vw, _mm_load_ps(q+qs+i)));
+    a2 = _mm_add_ps(a2, _mm_mul_ps(vw, _mm_load_ps(q+2*qs+i)));
+    a3 = _mm_add_ps(a3, _mm_mul_ps(vw, _mm_load_ps(q+3*qs+i)));
+  }
+
+  _mm_storeu_ps(d, hsum4(a0, a1, a2, a3));
+}
+#endif
+
+#ifdef DIST_AVX2
+__attribute__((target("avx2")))
+static int distAVX2(const unsigned char *a, const unsigned char *b, int n) {
+  __m256i acc = _mm256_setzero_si256();
+
+  for(int i=0; i<n; i+=32) {
+    __m256i a0 = _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i *)(a+i)));
+    __m256i b0 = _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i *)(b+i)));
+    __m256i a1 = _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i *)(a+i+16)));
+    __m256i b1 = _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i *)(b+i+16)));
+    __m256i d0 = _mm256_sub_epi16(a0, b0);
+    __m256i d1 = _mm256_sub_epi16(a1, b1);
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(d0, d0));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(d1, d1));
+  }
+
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+  return _mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("avx2")))
+static int distBoundAVX2(const unsigned char *a, const unsigned char *b, int n,
+			 int bound, int *len) {
+  int d=0;
+  for(int i=0; i<n; i+=DIST_ALIGN) {
+    __m256i a0 = _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i *)(a+i)));
+    __m256i b0 = _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i *)(b+i)));
+    __m256i a1 = _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i *)(a+i+16)));
+    __m256i b1 = _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i *)(b+i+16)));
+    __m256i d0 = _mm256_sub_epi16(a0, b0);
+    __m256i d1 = _mm256_sub_epi16(a1, b1);
+    __m256i acc = _mm256_add_epi32(_mm256_madd_epi16(d0, d0), _mm256_madd_epi16(d1, d1));
+
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    d += _mm_cvtsi128_si32(s);
+    if( d > bound ) {
+      *len = i+DIST_ALIGN;
+      return d;
+    }
+  }
+  *len = n;
+  return d;
+}
+
+__attribute__((target("avx2")))
+static void dot4AVX2(const unsigned char *q, size_t qs, const unsigned char *p,
+		     int n, int *d) {
+  __m256i a0 = _mm256_setzero_si256(), a1 = a0, a2 = a0, a3 = a0;
+
+  for(int i=0; i<n; i+=16) {
+    __m256i vp = _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i *)(p+i)));
+    a0 = _mm256_add_epi32(a0, _mm256_madd_epi16(vp,
+	   _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i *)(q+i)))));
+    a1 = _mm256_add_epi32(a1, _mm256_madd_epi16(vp,
+	   _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i *)(q+qs+i)))));
+    a2 = _mm256_add_epi32(a2, _mm256_madd_epi16(vp,
+	   _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i *)(q+2*qs+i)))));
+    a3 = _mm256_add_epi32(a3, _mm256_madd_epi16(vp,
+	   _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i *)(q+3*qs+i)))));
+  }
+
+  //Horizontal sums of the four accumulators at once
+  __m256i s = _mm256_hadd_epi32(_mm256_hadd_epi32(a0, a1), _mm256_hadd_epi32(a2, a3));
+  __m128i r = _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+  _mm_storeu_si128((__m128i *)d, r);
+}
+
+__attribute__((target("avx2")))
+static float distFloatAVX2(const float *a, const float *b, int n) {
+  __m256 acc = _mm256_setzero_ps();
+
+  for(int i=0; i<n; i+=8) {
+    __m256 d = _mm256_sub_ps(_mm256_load_ps(a+i), _mm256_load_ps(b+i));
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(d, d));
+  }
+
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2")))
+static void dot4FloatAVX2(const float *q, size_t qs, const float *w, int n,
+			  float *d) {
+  __m256 a0 = _mm256_setzero_ps(), a1 = a0, a2 = a0, a3 = a0;
+
+  for(int i=0; i<n; i+=8) {
+    __m256 vw = _mm256_load_ps(w+i);
+    a0 = _mm256_add_ps(a0, _mm256_mul_ps(vw, _mm256_load_ps(q+i)));
+    a1 = _mm256_add_ps(a1, _mm256_mul_ps(vw, _mm256_load_ps(q+qs+i)));
+    a2 = _mm256_add_ps(a2, _mm256_mul_ps(vw, _mm256_load_ps(q+2*qs+i)));
+    a3 = _mm256_add_ps(a3, _mm256_mul_ps(vw, _mm256_load_ps(q+3*qs+i)));
+  }
+
+  //Horizontal sums of the four accumulators at once
+  __m256 s = _mm256_hadd_ps(_mm256_hadd_ps(a0, a1), _mm256_hadd_ps(a2, a3));
+  _mm_storeu_ps(d, _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1)));
+}
+#endif
+
+distFunc distKernel() {
+#ifdef DIST_AVX2
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports("avx2") )
+    return distAVX2;
+#endif
+#ifdef __SSE2__
+  return distSSE2;
+#else
+  return distScalar;
+#endif
+}
+
+distBoundFunc distBoundKernel() {
+#ifdef DIST_AVX2
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports("avx2") )
+    return distBoundAVX2;
+#endif
+#ifdef __SSE2__
+  return distBoundSSE2;
+#else
+  return distBoundScalar;
+#endif
+}
+
+distFloatFunc distFloatKernel() {
+#ifdef DIST_AVX2
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports("avx2") )
+    return distFloatAVX2;
+#endif
+#ifdef __SSE2__
+  return distFloatSSE2;
+#else
+  return distFloatScalar;
+#endif
+}
+
+dot4Func dot4Kernel() {
+#ifdef DIST_AVX2
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports("avx2") )
+    return dot4AVX2;
+#endif
+#ifdef __SSE2__
+  return dot4SSE2;
+#else
+  return dot4Scalar;
+#endif
+}
+
+dot4FloatFunc dot4FloatKernel() {
+#ifdef DIST_AVX2
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports("avx2") )
+    return dot4FloatAVX2;
+#endif
+#ifdef __SSE2__
+  return dot4FloatSSE2;
+#else
+  return dot4FloatScalar;
+#endif
+}
@@ -0,0 +1,67 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#ifndef _DISTANCE_
+#define _DISTANCE_
+
+#include <cstddef>
+
+//Vectors are padded with zeros to a multiple of this length and
+//stored aligned to it
+#define DIST_ALIGN 32
+
+//Squared euclidean distance between two vectors of n 8-bit values
+//(n multiple of DIST_ALIGN, vectors aligned to DIST_ALIGN bytes)
+typedef int (*distFunc)(const unsigned char *a, const unsigned char *b, int n);
+
+//Same distance accumulated in blocks of DIST_ALIGN values, abandoned as
+//soon as the partial sum exceeds 'bound'. The number of values added is
+//returned in 'len', so the result is exact only if it is <= bound
+typedef int (*distBoundFunc)(const unsigned char *a, const unsigned char *b, int n,
+			     int bound, int *len);
+
+//Squared euclidean distance between two vectors of n floats (n multiple
+//of 8, vectors aligned to DIST_ALIGN bytes). The order of the sums depends
+//on the kernel, so results can differ in the last bits
+typedef float (*distFloatFunc)(const float *a, const float *b, int n);
+
+//Dot products of the 4 vectors of n 8-bit values q, q+qs, q+2qs and
+//q+3qs with the vector p, returned in d[0..3] (n multiple of DIST_ALIGN,
+//vectors aligned to DIST_ALIGN bytes)
+typedef void (*dot4Func)(const unsigned char *q, size_t qs, const unsigned char *p,
+			 int n, int *d);
+
+//Dot products of the 4 vectors of n floats q, q+qs, q+2qs and q+3qs with
+//the vector w, returned in d[0..3] (n multiple of 8, vectors aligned to
+//DIST_ALIGN bytes). As with distFloatFunc, the last bits can differ
+typedef void (*dot4FloatFunc)(const float *q, size_t qs, const float *w, int n,
+			      float *d);
+
+//Fastest distance kernels supported by the CPU (AVX2, SSE2 or scalar),
+//all of them but the float ones give exactly the same result
+distFunc distKernel();
+distBoundFunc distBoundKernel();
+distFloatFunc distFloatKernel();
+dot4Func dot4Kernel();
+dot4FloatFunc dot4FloatKernel();
+
+//Aligned buffer of n bytes initialized to 0
+unsigned char *newVectors(size_t n);
+void freeVectors(unsigned char *v);
+
+#endif
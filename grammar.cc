@@ -25,6 +25,7 @@
 #include <map>
 #include <vector>
 #include <algorithm>
+#include <pthread.h>
 #include "grammar.h"
 #include "cyktable.h"
 #include "logspace.h"
@@ -91,8 +92,43 @@ void Grammar::setSims(char *sims, char *info) {
     exit(1);
   }
 
-  //Initialize symbol classifier
-  RecSims = new recNN(fsims, ftype);
+  //Initialize symbol classifier: a model of recMLP or a database of
+  //samples for recNN
+  char magic[8];
+  bool mlp = fscanf(fsims, "%7s", magic) == 1 && !strcmp(magic, "MLP");
+  rewind(fsims);
+
+  if( mlp )
+    RecSims = new recMLP(fsims, ftype);
+  else
+    RecSims = new recNN(fsims, ftype);
+
+  fclose(fsims);
+  fclose(ftype);
+}
+
+//Approximate symbol classification with a beam of 'ef' prototypes
+void Grammar::setANN(int ef) {
+  RecSims->setANN(ef);
+}
+
+//Threads used to search the symbols database of each expression
+void Grammar::setThreads(int n) {
+  RecSims->setThreads(n);
+}
+
+//Cache of the classification of up to 'size' symbols, kept in 'file'
+//between runs (see saveCache)
+void Grammar::setCache(int size, const char *file) {
+  RecSims->setCache(size, file);
+}
+
+void Grammar::saveCache() {
+  RecSims->saveCache();
+}
+
+void Grammar::cacheStats(unsigned long *hits, unsigned long *lookups) {
+  RecSims->cacheStats(hits, lookups);
 }
 
 void Grammar::addInitSym(char *str) {
@@ -290,7 +326,7 @@ Grammar::~Grammar() {
 // }
 
 //Combine A and B elements to generate element S given production pd (S -> A B)
-CYKcell *Grammar::fusion(ProductionB *pd, CYKcell *A, CYKcell *B, int N) {
+CYKcell *Grammar::fusion(ProductionB *pd, CYKcell *A, CYKcell *B, int N, int RX, int RY) {
   CYKcell *S=NULL;
 
   //Get the combination probability according to production
@@ -332,15 +368,20 @@ CYKcell *Grammar::fusion(ProductionB *pd, CYKcell *A, CYKcell *B, int N) {
 }
 
 //CYK table initialization by terminal mathematical symbols
-void Grammar::initCYKterms(Sample *m, CYKtable *tcyk, int N, int K) {
-  int vec[15*15];
+void Grammar::initCYKterms(Sample *m, CYKtable *tcyk, int N, int K, bool verbose) {
+  //N-Best classification of all the components at once
+  const int NB=10;
+  int *vecs = new int[N*15*15];
+  int *cmys = new int[N], *ascs = new int[N], *dess = new int[N];
+  int *clases = new int[N*NB];
+  float *prs = new float[N*NB];
 
-  printf("\n1CC Symbols:\n");
+  if( verbose )
+    printf("\n1CC Symbols:\n");
 
   for(int i=0; i<N; i++) {
-    int cmy, asc, des;
-    m->getRegion(vec, i, &asc, &cmy, &des);
-    
+    int *vec = vecs + i*15*15;
+    m->getRegion(vec, i, &ascs[i], &cmys[i], &dess[i]);
 
 #ifdef VERBOSE
     printf("Component %d:\n", i);
@@ -357,16 +398,17 @@ void Grammar::initCYKterms(Sample *m, CYKtable *tcyk, int N, int K) {
       printf("\n");
     }
 #endif
+  }
+
+  RecSims->classifyBatch( vecs, N, NB, clases, prs );
+
+  for(int i=0; i<N; i++) {
+    int cmy=cmys[i], asc=ascs[i], des=dess[i];
+    int *clase = clases + i*NB;
+    float *pr = prs + i*NB;
 
     CYKcell *cd = new CYKcell(nonTerminals.size(), N);
     m->setRegion(cd, i);
-    
-    //N-Best classification
-    const int NB=10;
-    int clase[NB];
-    float pr[NB];
-
-    RecSims->classify( vec, NB, clase, pr );
 
     float pmax=0.5;
     for(list<ProductionT *>::iterator it=prodTerms.begin(); it!=prodTerms.end(); it++) {
@@ -418,23 +460,31 @@ void Grammar::initCYKterms(Sample *m, CYKtable *tcyk, int N, int K) {
     tcyk->add(1, cd);
     
     //Print components information
-    for(int j=0; j<K; j++) {
+    int x=cd->x, y=cd->y, s=cd->s, t=cd->t;
+    m->toImage(&x, &y, &s, &t);
+    for(int j=0; j<K && verbose; j++) {
       if( cd->ntsims[j] ) {
-        printf("%d_%d_%d_%d %.8f [%d] %s\n", cd->x, cd->y, cd->s, cd->t,
+        printf("%d_%d_%d_%d %.8f [%d] %s\n", x, y, s, t,
 	       exp(cd->ntsims[j]->pr), j, RecSims->strClass(cd->ntsims[j]->clase));
       }
     }
   }
 
+  delete[] vecs;
+  delete[] cmys;
+  delete[] ascs;
+  delete[] dess;
+  delete[] clases;
+  delete[] prs;
 }
 
 //Compute the dimensions of the reference symbol. It makes the parser
 //independent from image resolution
-void Grammar::detRefSymbol(CYKtable *tcyk) {
+void Grammar::detRefSymbol(CYKtable *tcyk, int *rx, int *ry, bool verbose) {
   vector<int> vmedx, vmedy;
   int nregs=0, lAr;
   float mAr=0;
-  RX=0, RY=0;
+  int RX=0, RY=0;
 
   for(CYKcell *r=tcyk->get(1); r; r=r->next) {
     int width = r->s - r->x;
@@ -488,17 +538,22 @@ void Grammar::detRefSymbol(CYKtable *tcyk) {
   RX = max(max(RX,vmedx[vmedx.size()/2]), lAr);
   RY = max(max(RY,vmedy[vmedy.size()/2]), lAr);
 
-  printf("\nReference symbol:\n");
-  printf("(RX,RY) = (%d,%d)\n", RX, RY);
+  if( verbose ) {
+    printf("\nReference symbol:\n");
+    printf("(RX,RY) = (%d,%d)\n", RX, RY);
+  }
+
+  *rx = RX;
+  *ry = RY;
 }
 
 
 //Compose symbols combining nearby connected components
-void Grammar::mergeCC(Sample *m, CYKtable *tcyk, int N) {
-  int vec[255];
+void Grammar::mergeCC(Sample *m, CYKtable *tcyk, int N, int RX, int RY, bool verbose) {
+  int vec[15*15];
   int *cand = new int[N];
+  vector<int> pairs, vecs, regs;
 
-  printf("\n2CC Symbols:\n");
   for(int i=0; i<N; i++) {
     //Get the list of components candidate to combine with  component 'i'
     int nc = m->getCandidates(i, cand, RX/2, RY);
@@ -511,110 +566,158 @@ void Grammar::mergeCC(Sample *m, CYKtable *tcyk, int N) {
       int asc, cmy, des;
       m->getRegion(vec, i, cand[j], &asc, &cmy, &des);
 
-      CYKcell *cd = new CYKcell(nonTerminals.size(), N);
-      m->setRegion(cd, i, cand[j]);
+      pairs.push_back(i);
+      pairs.push_back(cand[j]);
+      vecs.insert(vecs.end(), vec, vec+15*15);
+      regs.push_back(asc);
+      regs.push_back(cmy);
+      regs.push_back(des);
+    }
+  }
 
-      //N-Best classification
-      const int NB=5;
-      int clase[NB];
-      float pr[NB];
+  //N-Best classification of all the combinations at once
+  const int NB=5;
+  int NP = pairs.size()/2;
+  vector<int> clases(NP*NB);
+  vector<float> prs(NP*NB);
+  if( NP > 0 )
+    RecSims->classifyBatch( &vecs[0], NP, NB, &clases[0], &prs[0] );
+
+  if( verbose )
+    printf("\n2CC Symbols:\n");
+  for(int n=0; n<NP; n++) {
+    int i = pairs[2*n], cj = pairs[2*n+1];
+    int asc = regs[3*n], cmy = regs[3*n+1], des = regs[3*n+2];
+    int *clase = &clases[n*NB];
+    float *pr = &prs[n*NB];
 
-      RecSims->classify( vec, NB, clase, pr );
+    CYKcell *cd = new CYKcell(nonTerminals.size(), N);
+    m->setRegion(cd, i, cj);
 
-      float pmax= (pr[NB-1] > 0.6) ? pr[NB-1]-0.1 : 0.5;
-      bool combined=false;
-      for(list<ProductionT *>::iterator it=prodTerms.begin(); it!=prodTerms.end(); it++) {
-	ProductionT *prod = *it;
+    float pmax= (pr[NB-1] > 0.6) ? pr[NB-1]-0.1 : 0.5;
+    bool combined=false;
+    for(list<ProductionT *>::iterator it=prodTerms.begin(); it!=prodTerms.end(); it++) {
+      ProductionT *prod = *it;
 
-	for(int k=0; k<NB; k++)
-	  if( prod->getClass( clase[k] ) && pr[k] > pmax && prod->getPrior(clase[k]) > -FLT_MAX ) {
-	    //Increase probability of frequent combinations
-	    if( pr[k] > 0.7 && esFreqSym(RecSims->strClass(clase[k])) ) {
-	      pr[k] *= 1.1;
-	      if( pr[k] > 1.0 )
-		pr[k] = 1.0;
-	    }
+      for(int k=0; k<NB; k++)
+	if( prod->getClass( clase[k] ) && pr[k] > pmax && prod->getPrior(clase[k]) > -FLT_MAX ) {
+	  //Increase probability of frequent combinations
+	  if( pr[k] > 0.7 && esFreqSym(RecSims->strClass(clase[k])) ) {
+	    pr[k] *= 1.1;
+	    if( pr[k] > 1.0 )
+	      pr[k] = 1.0;
+	  }
 
-	    if( pr[k] >= 0.65  && prod->getPrior(clase[k]) > -FLT_MAX ) {
-	      //Naive probability scaling
-	      pr[k] = pr[k]*pr[k]*pr[k];
+	  if( pr[k] >= 0.65  && prod->getPrior(clase[k]) > -FLT_MAX ) {
+	    //Naive probability scaling
+	    pr[k] = pr[k]*pr[k]*pr[k];
 	      
-	      //Select the vertical centroid according to symbol type
-	      int cen, type = RecSims->symType(clase[k]);
-	      if( type==0 )       cen = cmy; //Normal
-	      else if ( type==1 ) cen = asc; //Ascendant
-	      else                cen = des; //Descending
-
-	      cd->ntsims[prod->getNoTerm()] = new Symbol(clase[k], 
-							  prod->getPrior(clase[k])+log(pr[k]), N);
-	      cd->ntsims[prod->getNoTerm()]->pt = prod;
-	      cd->ntsims[prod->getNoTerm()]->ccc[i] = true;
-	      cd->ntsims[prod->getNoTerm()]->ccc[m->rp2cmp(cand[j])] = true;
-	      //Central baseline
-	      cd->ntsims[prod->getNoTerm()]->lbhor = cen;
-	      cd->ntsims[prod->getNoTerm()]->rbhor = cen;
-	      //Upper baseline
-	      if( type!=1 ) {
-		cd->ntsims[prod->getNoTerm()]->lbsup = cd->y + 0.1*(cen-cd->y);
-		cd->ntsims[prod->getNoTerm()]->rbsup = cd->ntsims[prod->getNoTerm()]->lbsup;
-	      }
-	      else {
-		cd->ntsims[prod->getNoTerm()]->lbsup = (cd->y + cen)/2;
-		cd->ntsims[prod->getNoTerm()]->rbsup = cd->ntsims[prod->getNoTerm()]->lbsup;
-	      }
-	      //Lower baseline
-	      if( type!=2 ) {
-		cd->ntsims[prod->getNoTerm()]->lbsub = cen + 0.9*(cd->t-cen);
-		cd->ntsims[prod->getNoTerm()]->rbsub = cd->ntsims[prod->getNoTerm()]->lbsub;
-	      }
-	      else {
-		cd->ntsims[prod->getNoTerm()]->lbsub = (cen + cd->t)/2;
-		cd->ntsims[prod->getNoTerm()]->rbsub = cd->ntsims[prod->getNoTerm()]->lbsub;
-	      }
+	    //Select the vertical centroid according to symbol type
+	    int cen, type = RecSims->symType(clase[k]);
+	    if( type==0 )       cen = cmy; //Normal
+	    else if ( type==1 ) cen = asc; //Ascendant
+	    else                cen = des; //Descending
+
+	    cd->ntsims[prod->getNoTerm()] = new Symbol(clase[k], 
+							prod->getPrior(clase[k])+log(pr[k]), N);
+	    cd->ntsims[prod->getNoTerm()]->pt = prod;
+	    cd->ntsims[prod->getNoTerm()]->ccc[i] = true;
+	    cd->ntsims[prod->getNoTerm()]->ccc[m->rp2cmp(cj)] = true;
+	    //Central baseline
+	    cd->ntsims[prod->getNoTerm()]->lbhor = cen;
+	    cd->ntsims[prod->getNoTerm()]->rbhor = cen;
+	    //Upper baseline
+	    if( type!=1 ) {
+	      cd->ntsims[prod->getNoTerm()]->lbsup = cd->y + 0.1*(cen-cd->y);
+	      cd->ntsims[prod->getNoTerm()]->rbsup = cd->ntsims[prod->getNoTerm()]->lbsup;
+	    }
+	    else {
+	      cd->ntsims[prod->getNoTerm()]->lbsup = (cd->y + cen)/2;
+	      cd->ntsims[prod->getNoTerm()]->rbsup = cd->ntsims[prod->getNoTerm()]->lbsup;
+	    }
+	    //Lower baseline
+	    if( type!=2 ) {
+	      cd->ntsims[prod->getNoTerm()]->lbsub = cen + 0.9*(cd->t-cen);
+	      cd->ntsims[prod->getNoTerm()]->rbsub = cd->ntsims[prod->getNoTerm()]->lbsub;
+	    }
+	    else {
+	      cd->ntsims[prod->getNoTerm()]->lbsub = (cen + cd->t)/2;
+	      cd->ntsims[prod->getNoTerm()]->rbsub = cd->ntsims[prod->getNoTerm()]->lbsub;
+	    }
 	      
-	      combined=true;
+	    combined=true;
 	      
-	      printf("%d_%d_%d_%d %.8f [%d] %s\n", cd->x, cd->y, cd->s, cd->t,
+	    if( verbose ) {
+	      int x=cd->x, y=cd->y, s=cd->s, t=cd->t;
+	      m->toImage(&x, &y, &s, &t);
+	      printf("%d_%d_%d_%d %.8f [%d] %s\n", x, y, s, t,
 		     exp(cd->ntsims[prod->getNoTerm()]->pr), prod->getNoTerm(),
 		     RecSims->strClass(cd->ntsims[prod->getNoTerm()]->clase));
 	    }
 	  }
-      }
-      
-      if( combined ) //Add to parsing table (size=2)
-	tcyk->add(2, cd);
-      else
-	delete cd;
+	}
     }
+      
+    if( combined ) //Add to parsing table (size=2)
+      tcyk->add(2, cd);
+    else
+      delete cd;
   }
 
   delete[] cand;
 }
 
+//Parse the sample printing the process and the LaTeX output
 void Grammar::parse(Sample *m) {
+  cyk(m, true);
+}
+
+//Parse the sample without printing anything and return the result
+ParseResult Grammar::recognize(Sample *m) {
+  return cyk(m, false);
+}
+
+ParseResult Grammar::cyk(Sample *m, bool verbose) {
   int N = m->nComponents();
   int K = nonTerminals.size();
+  int RX, RY;
+
+  if( N == 0 ) { //Empty sample
+    CYKtable tcyk( N, K );
+    if( verbose )
+      print_latex(m, &tcyk, N);
+    return getResult(m, &tcyk, N);
+  }
 
   //Cocke-Younger-Kasami (CYK) algorithm for 2D SCFG
 
   CYKtable tcyk( N, K );
 
   //CYK table initialization
-  initCYKterms(m, &tcyk, N, K);
+  initCYKterms(m, &tcyk, N, K, verbose);
 
   //Compute reference symbol
-  detRefSymbol( &tcyk );
+  detRefSymbol( &tcyk, &RX, &RY, verbose );
 
   //Compose symbols combining nearby connected components
-  mergeCC(m, &tcyk, N);
+  mergeCC(m, &tcyk, N, RX, RY, verbose);
+
+  if( verbose ) {
+    //Only the symbols searched one by one skip distance computations
+    float sk = RecSims->skipped();
+    if( sk >= 0 )
+      printf("\nClassifier: %.1f%% of the distance computations skipped\n",
+	     100*sk);
+  }
 
-  LogSpace **logspace = new LogSpace*[N];
+  LogSpace **logspace = new LogSpace*[N+1];
   list<CYKcell*> c1setH, c1setV, c1setU, c1setI; 
 
   //Initialization of spatial data structure for size=1
   logspace[1] = new LogSpace(tcyk.get(1), N, RX, RY);
 
-  printf("\nCYK parsing:\n");
+  if( verbose )
+    printf("\nCYK parsing:\n");
 
   for(int tsize=2; tsize<=N; tsize++) {
 
@@ -641,7 +744,7 @@ void Grammar::parse(Sample *m) {
 	    ((ProductionB*)*it)->getData( NULL, &pa, &pb );
 
 	    if( c1->ntsims[ pa ] && (*c2)->ntsims[ pb ] ) {
-	      CYKcell *cd = fusion(*it, c1, *c2, N);
+	      CYKcell *cd = fusion(*it, c1, *c2, N, RX, RY);
 	      
 	      if( cd )
 		tcyk.add(tsize, cd); //Add new hypothesis to the table
@@ -656,7 +759,7 @@ void Grammar::parse(Sample *m) {
 	    ((ProductionB*)*it)->getData( NULL, &pa, &pb );
 
 	    if( c1->ntsims[ pa ] && (*c2)->ntsims[ pb ] ) {
-	      CYKcell *cd = fusion(*it, c1, *c2, N);
+	      CYKcell *cd = fusion(*it, c1, *c2, N, RX, RY);
 		
 	      if( cd )
 		tcyk.add(tsize, cd); //Add new hypothesis to the table
@@ -670,7 +773,7 @@ void Grammar::parse(Sample *m) {
 	    ((ProductionB*)*it)->getData( NULL, &pa, &pb );
 	    
 	    if( c1->ntsims[ pa ] && (*c2)->ntsims[ pb ] ) {
-	      CYKcell *cd = fusion(*it, c1, *c2, N);
+	      CYKcell *cd = fusion(*it, c1, *c2, N, RX, RY);
 	      
 	      if( cd )
 		tcyk.add(tsize, cd); //Add new nypothesis to the table
@@ -684,7 +787,7 @@ void Grammar::parse(Sample *m) {
 	    ((ProductionB*)*it)->getData( NULL, &pa, &pb );
 	    
 	    if( c1->ntsims[ pa ] && (*c2)->ntsims[ pb ] ) {
-	      CYKcell *cd = fusion(*it, c1, *c2, N);
+	      CYKcell *cd = fusion(*it, c1, *c2, N, RX, RY);
 	      
 	      if( cd )
 		tcyk.add(tsize, cd); //Add new hypothesis to the table
@@ -699,7 +802,7 @@ void Grammar::parse(Sample *m) {
 	    ((ProductionB*)*it)->getData( NULL, &pa, &pb );
 	    
 	    if( c1->ntsims[ pb ] && (*c2)->ntsims[ pa ] ) {
-	      CYKcell *cd = fusion(*it, *c2, c1, N);
+	      CYKcell *cd = fusion(*it, *c2, c1, N, RX, RY);
 	      
 	      if( cd )
 		tcyk.add(tsize, cd); //Add new hypothesis to the table
@@ -713,7 +816,7 @@ void Grammar::parse(Sample *m) {
 	    ((ProductionB*)*it)->getData( NULL, &pa, &pb );
 	    
 	    if( c1->ntsims[ pb ] && (*c2)->ntsims[ pa ] ) {
-	      CYKcell *cd = fusion(*it, *c2, c1, N);
+	      CYKcell *cd = fusion(*it, *c2, c1, N, RX, RY);
 	      
 	      if( cd )
 		tcyk.add(tsize, cd); //Add new hypothesis to the table
@@ -728,7 +831,7 @@ void Grammar::parse(Sample *m) {
 	    ((ProductionB*)*it)->getData( NULL, &pa, &pb );
 
 	    if( c1->ntsims[ pa ] && (*c2)->ntsims[ pb ] ) {
-	      CYKcell *cd = fusion(*it, c1, *c2, N);
+	      CYKcell *cd = fusion(*it, c1, *c2, N, RX, RY);
 		
 	      if( cd )
 		tcyk.add(tsize, cd); //Add new hypothesis to the table
@@ -759,108 +862,125 @@ void Grammar::parse(Sample *m) {
 
 
   //Free memory
-  for(int i=1; i<N; i++)
+  for(int i=1; i<max(N,2); i++)
     delete logspace[i];
   delete[] logspace;
 
-  int total=0;
-  for(int i=1; i<=N; i++) {
-    printf("Size %d: Nodes generated %d\n", i, tcyk.size(i));
-    total += tcyk.size(i);
+  if( verbose ) {
+    int total=0;
+    for(int i=1; i<=N; i++) {
+      printf("Size %d: Nodes generated %d\n", i, tcyk.size(i));
+      total += tcyk.size(i);
+    }
+    printf("\nTotal generated = %d\n\n", total);
+
+    //Print LaTeX output of most probable hypothesis
+    print_latex(m, &tcyk, N);
   }
-  printf("\nTotal generated = %d\n\n", total);
 
-  //Print LaTeX output of most probable hypothesis
-  print_latex(&tcyk, N);
+  return getResult(m, &tcyk, N);
 }
 
+//Most probable hypothesis of an initial symbol that covers all the
+//components or, if none, of the largest number of components available.
+//Its initial symbol and size are returned in 'ntini' and 'nsy'
+CYKcell *Grammar::bestParse(CYKtable *T, int N, int *ntini, int *nsy) {
+  for(*nsy=N; *nsy > 0; (*nsy)--) {
+    CYKcell *cbest=NULL;
+    float best=-FLT_MAX;
 
-void Grammar::print_latex(CYKtable *T, int N) {
-  CYKcell *cparse=T->get(N);
-  int ntini=0;
-
-  if( cparse ) {
-    cparse = NULL;
-    float best = -FLT_MAX;
-    for(CYKcell *c1=T->get(N); c1; c1=c1->next) {
+    for(CYKcell *c1=T->get(*nsy); c1; c1=c1->next)
       for(list<int>::iterator it=initsyms.begin(); it!=initsyms.end(); it++) {
 	if( c1->ntsims[*it] && c1->ntsims[*it]->pr > best ) {
-	  cparse = c1;
-	  ntini = *it;
-	  best = c1->ntsims[ntini]->pr;
+	  cbest = c1;
+	  *ntini = *it;
+	  best = c1->ntsims[*ntini]->pr;
 	}
       }
-    }
-    if( cparse ) {
-      
-      printf("Used rules:\n");
-      viterbi(cparse, ntini);
-      printf("\n");
 
-      if( cparse->ntsims[ntini]->prod ) {
-	printf("Symbols:\n");
-	cparse->ntsims[ntini]->prod->printComps(cparse,ntini);
-	printf("\nLaTeX: ");
-	cparse->ntsims[ntini]->prod->printOut(cparse);
-      }
-      else {
-	printf("LaTeX: ");
-	printf("%s", cparse->ntsims[ntini]->pt->getTeX(cparse->ntsims[ntini]->clase));
-      }
-      printf("\n");
-    }
+    if( cbest )
+      return cbest;
   }
 
-  //If no hypothesis of size=N is available, then look for hypotheses of minor size
+  return NULL;
+}
+
+ParseResult Grammar::getResult(Sample *m, CYKtable *T, int N) {
+  ParseResult res;
+  int ntini, nsy;
+  CYKcell *cparse = bestParse(T, N, &ntini, &nsy);
+
+  res.page = m->getPage();
+  m->bbox(&res.rx, &res.ry, &res.rs, &res.rt);
+  m->toImage(&res.rx, &res.ry, &res.rs, &res.rt);
+
   if( !cparse ) {
-    int nsy = N-1;
-    cparse=NULL;
-    while( !cparse && nsy > 0 ) {
-      cparse = T->get(nsy);
-
-      if( cparse ) {
-	float best=-FLT_MAX;
-	CYKcell *cbest=NULL;
-	for(CYKcell *c1=cparse; c1; c1=c1->next)
-	  for(list<int>::iterator it=initsyms.begin(); it!=initsyms.end(); it++) {
-	    if( c1->ntsims[*it] && c1->ntsims[*it]->pr > best ) {
-	      cbest = c1;
-	      ntini = *it;
-	      best = c1->ntsims[ntini]->pr;
-	    }
-	  }
+    res.nsyms = 0;
+    res.partial = true;
+    res.x = res.y = res.s = res.t = -1;
+    res.pr = -FLT_MAX;
+    res.latex = "\\emptyset";
+    return res;
+  }
 
-	if( cbest ) {
-	  cparse = cbest;
-	  break;
-	}
-	else
-	  cparse = NULL;
-      }
-      nsy--;
-    }
+  res.nsyms = nsy;
+  res.partial = nsy < N;
+  res.x = cparse->x;
+  res.y = cparse->y;
+  res.s = cparse->s;
+  res.t = cparse->t;
+  m->toImage(&res.x, &res.y, &res.s, &res.t);
+  res.pr = cparse->ntsims[ntini]->pr;
+
+  if( cparse->ntsims[ntini]->prod )
+    cparse->ntsims[ntini]->prod->getOut(cparse, &res.latex);
+  else
+    res.latex = cparse->ntsims[ntini]->pt->getTeX(cparse->ntsims[ntini]->clase);
+
+  return res;
+}
 
-    if( cparse ) {
-      printf("Used rules:\n");
-      viterbi(cparse, ntini);
-      printf("\n");
+void Grammar::print_latex(Sample *m, CYKtable *T, int N) {
+  int ntini, nsy;
+  CYKcell *cparse = bestParse(T, N, &ntini, &nsy);
 
-      if( cparse->ntsims[ntini]->prod ) {
-	printf("Symbols:\n");
-	cparse->ntsims[ntini]->prod->printComps(cparse,ntini);
-	printf("Partial Recognition (%d symbols)\n", nsy);
-	printf("LaTeX: ");
-	cparse->ntsims[ntini]->prod->printOut(cparse);
-	printf("\n");
-      }
-      else {
-	printf("Partial Recognition (%d symbols)\n", nsy);
-	printf("LaTeX: %s\n",
-	       cparse->ntsims[ntini]->pt->getTeX(cparse->ntsims[ntini]->clase));
-      }
+  //If any expression can be parsed, print $\emptyset$
+  if( !cparse ) {
+    printf("Partial Recognition (0 symbols)\nLaTeX: \\emptyset\n");
+    return;
+  }
+
+  printf("Used rules:\n");
+  viterbi(cparse, ntini);
+  printf("\n");
+
+  if( nsy == N ) {
+    if( cparse->ntsims[ntini]->prod ) {
+      printf("Symbols:\n");
+      cparse->ntsims[ntini]->prod->printComps(cparse,ntini,m);
+      printf("\nLaTeX: ");
+      cparse->ntsims[ntini]->prod->printOut(cparse);
+    }
+    else {
+      printf("LaTeX: ");
+      printf("%s", cparse->ntsims[ntini]->pt->getTeX(cparse->ntsims[ntini]->clase));
+    }
+    printf("\n");
+  }
+  else { //If no hypothesis of size=N is available, the one of minor size
+    if( cparse->ntsims[ntini]->prod ) {
+      printf("Symbols:\n");
+      cparse->ntsims[ntini]->prod->printComps(cparse,ntini,m);
+      printf("Partial Recognition (%d symbols)\n", nsy);
+      printf("LaTeX: ");
+      cparse->ntsims[ntini]->prod->printOut(cparse);
+      printf("\n");
+    }
+    else {
+      printf("Partial Recognition (%d symbols)\n", nsy);
+      printf("LaTeX: %s\n",
+	     cparse->ntsims[ntini]->pt->getTeX(cparse->ntsims[ntini]->clase));
     }
-    else //If any expression can be parsed, print $\emptyset$
-      printf("Partial Recognition (0 symbols)\nLaTeX: \\emptyset\n");
   }
 }
 
@@ -891,3 +1011,71 @@ void Grammar::viterbi(CYKcell *cell, int n) {
 	   cell->ntsims[n]->pt->getTeX(cell->ntsims[n]->clase));
   }
 }
+
+
+//Parsing of the expression regions of a page by several threads
+struct PageTask{
+  Grammar *g;
+  vector<Sample *> *regions;
+  vector<ParseResult> *res;
+  int next;
+  pthread_mutex_t lock;
+};
+
+static void *pageWorker(void *arg) {
+  PageTask *task = (PageTask *)arg;
+
+  while( true ) {
+    pthread_mutex_lock(&task->lock);
+    int r = task->next++;
+    pthread_mutex_unlock(&task->lock);
+
+    if( r >= (int)task->regions->size() )
+      break;
+
+    (*task->res)[r] = task->g->recognize( (*task->regions)[r] );
+  }
+
+  return NULL;
+}
+
+//Split the page into expression regions and parse them concurrently
+//using 'nthreads' threads. It returns one result per region
+vector<ParseResult> Grammar::recognizePage(Sample *page, int nthreads) {
+  vector< vector<int> > groups;
+  page->segment(&groups);
+
+  vector<Sample *> regions(groups.size());
+  for(int i=0; i<(int)groups.size(); i++)
+    regions[i] = new Sample(page, groups[i]);
+
+  vector<ParseResult> res(regions.size());
+
+  PageTask task;
+  task.g = this;
+  task.regions = &regions;
+  task.res = &res;
+  task.next = 0;
+  pthread_mutex_init(&task.lock, NULL);
+
+  if( nthreads > (int)regions.size() )
+    nthreads = regions.size();
+
+  if( nthreads <= 1 )
+    pageWorker(&task);
+  else {
+    pthread_t *th = new pthread_t[nthreads];
+    for(int i=0; i<nthreads; i++)
+      pthread_create(&th[i], NULL, pageWorker, &task);
+    for(int i=0; i<nthreads; i++)
+      pthread_join(th[i], NULL);
+    delete[] th;
+  }
+
+  pthread_mutex_destroy(&task.lock);
+
+  for(int i=0; i<(int)regions.size(); i++)
+    delete regions[i];
+
+  return res;
+}
@@ -25,34 +25,53 @@ class gParser;
 #include <string>
 #include <map>
 #include <list>
+#include <vector>
 #include "production.h"
 #include "recNN.h"
+#include "recMLP.h"
 #include "sample.h"
 #include "cyktable.h"
 #include "gparser.h"
 
 using namespace std;
 
+//Recognition result of a sample
+struct ParseResult{
+  string latex;   //LaTeX transcription
+  double pr;      //Log-probability of the hypothesis
+  int nsyms;      //Number of connected components covered
+  bool partial;   //True if not all the components were covered
+  int x, y, s, t; //Region of the hypothesis
+  int page;       //Page of the sample (multi-page input)
+  int rx, ry, rs, rt; //Region of the sample in the page
+};
+
 class Grammar{
   map<string,int> nonTerminals;
 
   list<int> initsyms;
   list<ProductionB *> prodsH, prodsV, prodsVs, prodsIns, prodsSSE;
   list<ProductionT *> prodTerms;
-  recNN *RecSims;
-
-  int RX, RY;
+  SymClassifier *RecSims;
 
-  void initCYKterms(Sample *m, CYKtable *tcyk, int N, int K);
-  void detRefSymbol(CYKtable *tcyk);
-  void mergeCC(Sample *m, CYKtable *tcyk, int N);
+  void initCYKterms(Sample *m, CYKtable *tcyk, int N, int K, bool verbose);
+  void detRefSymbol(CYKtable *tcyk, int *rx, int *ry, bool verbose);
+  void mergeCC(Sample *m, CYKtable *tcyk, int N, int RX, int RY, bool verbose);
   void print_spatialRel(CYKcell *cell, int n);
   const char *key2str(int k);
+  ParseResult cyk(Sample *m, bool verbose);
+  CYKcell *bestParse(CYKtable *T, int N, int *ntini, int *nsy);
+  ParseResult getResult(Sample *m, CYKtable *T, int N);
  public:
   Grammar(char *path);
   ~Grammar();
 
   void setSims(char *sims, char *info);
+  void setANN(int ef);
+  void setThreads(int n);
+  void setCache(int size, const char *file=NULL);
+  void saveCache();
+  void cacheStats(unsigned long *hits, unsigned long *lookups);
   void addInitSym(char *str);
   void addNoTerminal(char *str);
   void addTerminal(char *str, char *path);
@@ -65,10 +84,12 @@ class Grammar{
   void addRuleSSE(float pr, char *S, char *A, char *B, char *out);
   void addRuleIns(float pr, char *S, char *A, char *B, char *out);
 
-  CYKcell *fusion(ProductionB *pd, CYKcell *A, CYKcell *B, int N);
+  CYKcell *fusion(ProductionB *pd, CYKcell *A, CYKcell *B, int N, int RX, int RY);
   void parse(Sample *m);
+  ParseResult recognize(Sample *m);
+  vector<ParseResult> recognizePage(Sample *page, int nthreads);
   //void print();
-  void print_latex(CYKtable *T, int N);
+  void print_latex(Sample *m, CYKtable *T, int N);
   void viterbi(CYKcell *cell, int n);
 };
 
@@ -0,0 +1,205 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "sample.h"
+
+using namespace std;
+
+//Check that labeling the connected components in parallel stripes gives
+//the same components as the serial labeling. Every image, and a tall
+//synthetic page with components across many stripe boundaries (8-bit
+//and 1-bit), is labeled with 1 thread and with several ones, and the
+//components saved by Sample::saveComponents are compared byte by byte
+
+#define PAGE_X 1200
+#define PAGE_Y 4096
+
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-t threads] [image ...]\n", prog);
+  fprintf(stderr, "  -t threads  Largest number of threads tried (default: 16)\n");
+}
+
+static unsigned int seed = 12345;
+
+static int nextRand(int n) {
+  seed = seed*1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+static void ink(unsigned char *pix, int x, int y, int g) {
+  if( x >= 0 && x < PAGE_X && y >= 0 && y < PAGE_Y )
+    pix[(size_t)y*PAGE_X + x] = g;
+}
+
+//Synthetic page of 8-bit gray levels: blobs of many sizes, long strokes
+//that cross many stripes, U shapes whose arms only join below the bottom
+//of a stripe and diagonal lines that are 8-connected only
+static unsigned char *syntheticPage() {
+  unsigned char *pix = new unsigned char[(size_t)PAGE_X*PAGE_Y];
+  memset(pix, 255, (size_t)PAGE_X*PAGE_Y);
+
+  for(int i=0; i<6000; i++) {
+    int x = nextRand(PAGE_X), y = nextRand(PAGE_Y);
+    int w = 1 + nextRand(12), h = 1 + nextRand(12), g = nextRand(200);
+    for(int v=0; v<h; v++)
+      for(int u=0; u<w; u++)
+	if( nextRand(4) )
+	  ink(pix, x+u, y+v, g + nextRand(50));
+  }
+
+  for(int i=0; i<40; i++) {
+    int x = nextRand(PAGE_X), y = nextRand(PAGE_Y), h = 64 + nextRand(1024);
+    for(int v=0; v<h; v++)
+      ink(pix, x, y+v, nextRand(128));
+  }
+
+  for(int i=0; i<60; i++) {
+    int x = nextRand(PAGE_X-40), y = nextRand(PAGE_Y), h = 8 + nextRand(200);
+    for(int v=0; v<h; v++) {
+      ink(pix, x, y+v, 0);
+      ink(pix, x+30, y+v, 0);
+    }
+    for(int u=0; u<=30; u++)
+      ink(pix, x+u, i%2 ? y+h : y-1, 0);
+  }
+
+  for(int i=0; i<40; i++) {
+    int x = nextRand(PAGE_X), y = nextRand(PAGE_Y), n = 32 + nextRand(300);
+    int dx = nextRand(2) ? 1 : -1;
+    for(int v=0; v<n; v++)
+      ink(pix, x + dx*v, y+v, 0);
+  }
+
+  return pix;
+}
+
+//Components of a sample labeled with 'threads' threads, as saved
+static string labeled(Sample *m) {
+  char path[] = "/tmp/labelcheckXXXXXX";
+  int fd = mkstemp(path);
+  if( fd < 0 ) {
+    fprintf(stderr, "Error creating a temporary file\n");
+    exit(-1);
+  }
+  close(fd);
+
+  m->saveComponents(path);
+
+  string s;
+  FILE *f = fopen(path, "rb");
+  char buf[4096];
+  size_t n;
+  while( f && (n = fread(buf, 1, sizeof(buf), f)) > 0 )
+    s.append(buf, n);
+  if( f )
+    fclose(f);
+  unlink(path);
+
+  return s;
+}
+
+//Label with every number of threads in 'ths' and compare with 1 thread
+static bool check(const char *name, const char *path, const unsigned char *pix,
+		  int bpp, const vector<int> &ths) {
+  string ref;
+  int nc=0;
+  bool ok=true;
+
+  for(int i=-1; i<(int)ths.size(); i++) {
+    Sample::setThreads(i < 0 ? 1 : ths[i]);
+
+    Sample *m;
+    if( path )
+      m = new Sample((char *)path);
+    else
+      m = new Sample(pix, PAGE_X, PAGE_Y, bpp==1 ? (PAGE_X+7)/8 : PAGE_X, bpp);
+
+    string s = labeled(m);
+    if( i < 0 ) {
+      ref = s;
+      nc = m->nComponents();
+    }
+    else if( s != ref ) {
+      printf("%s: %d threads give other components than 1 thread\n", name, ths[i]);
+      ok = false;
+    }
+    delete m;
+  }
+
+  if( ok )
+    printf("%s: %d components, same with %d to %d threads\n", name, nc,
+	   ths.front(), ths.back());
+
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  int maxThreads=16;
+  int opt;
+
+  while( (opt = getopt(argc, argv, "t:")) != -1 ) {
+    switch( opt ) {
+    case 't': maxThreads = atoi(optarg); break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if( maxThreads < 2 ) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  //Odd numbers too, so that stripe boundaries fall everywhere
+  vector<int> ths;
+  for(int t=2; t<=maxThreads; t += t < 4 ? 1 : t/2)
+    ths.push_back(t);
+  if( ths.back() != maxThreads )
+    ths.push_back(maxThreads);
+
+  bool ok=true;
+  for(int i=optind; i<argc; i++)
+    ok = check(argv[i], argv[i], NULL, 8, ths) && ok;
+
+  unsigned char *pix = syntheticPage();
+  ok = check("synthetic page (8-bit)", NULL, pix, 8, ths) && ok;
+
+  //The same page as 1-bit pixels, ink where it is darker than white
+  int rb = (PAGE_X+7)/8;
+  unsigned char *bits = new unsigned char[(size_t)rb*PAGE_Y];
+  memset(bits, 0, (size_t)rb*PAGE_Y);
+  for(int y=0; y<PAGE_Y; y++)
+    for(int x=0; x<PAGE_X; x++)
+      if( pix[(size_t)y*PAGE_X + x] < 255 )
+	bits[(size_t)y*rb + x/8] |= 128 >> (x%8);
+  ok = check("synthetic page (1-bit)", NULL, bits, 1, ths) && ok;
+
+  delete[] pix;
+  delete[] bits;
+
+  printf(ok ? "Parallel labeling OK\n" : "Parallel labeling FAILED\n");
+
+  return ok ? 0 : 1;
+}
@@ -21,6 +21,15 @@
 
 using namespace std;
 
+MFSET::MFSET(int n) {
+  rowWidth = n;
+  nElem = nSets = n;
+  mf = new int[nElem];
+
+  for(int i=0; i<nElem; i++)
+    mf[i] = -1;
+}
+
 MFSET::MFSET(int dimX, int dimY) {
   rowWidth = dimX;
   nElem = nSets = dimX * dimY;
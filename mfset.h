@@ -29,6 +29,7 @@ class MFSET{
   int nSets;
 
 public:
+  MFSET(int n);
   MFSET(int dimX, int dimY);
   ~MFSET();
 
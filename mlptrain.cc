@@ -0,0 +1,118 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/time.h>
+#include <unistd.h>
+#include "recMLP.h"
+
+using namespace std;
+
+//Train the multilayer perceptron classifier of the symbols from a
+//database of samples. The model can replace the database in the grammar,
+//whose samples file can be either of them
+
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-h hidden] [-e epochs] [-l rate] [-s seed] database types model\n", prog);
+  fprintf(stderr, "  -h hidden  Hidden units, 0 for a linear model (default: 64)\n");
+  fprintf(stderr, "  -e epochs  Passes over the database (default: 30)\n");
+  fprintf(stderr, "  -l rate    Initial learning rate (default: 0.01)\n");
+  fprintf(stderr, "  -s seed    Seed of the initial weights and the order (default: 1)\n");
+}
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+int main(int argc, char *argv[]) {
+  int H=64, epochs=30, seed=1;
+  float rate=0.01;
+  int opt;
+
+  while( (opt = getopt(argc, argv, "h:e:l:s:")) != -1 ) {
+    switch( opt ) {
+    case 'h': H = atoi(optarg); break;
+    case 'e': epochs = atoi(optarg); break;
+    case 'l': rate = atof(optarg); break;
+    case 's': seed = atoi(optarg); break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if( argc-optind != 3 || H < 0 || epochs < 1 || rate <= 0 ) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  FILE *bd = fopen(argv[optind], "r");
+  if( !bd ) {
+    fprintf(stderr, "Error loading symbols file '%s'\n", argv[optind]);
+    return -1;
+  }
+  FILE *tp = fopen(argv[optind+1], "r");
+  if( !tp ) {
+    fprintf(stderr, "Error loading symbols information file '%s'\n", argv[optind+1]);
+    return -1;
+  }
+
+  double t0 = now();
+  recMLP mlp(bd, tp, H, epochs, rate, seed);
+  fprintf(stderr, "Trained in %.1f s\n", now()-t0);
+
+  //Accuracy on the training samples
+  rewind(bd);
+  int N, D=225, ok=0;
+  if( fscanf(bd, "%d", &N) != 1 )
+    N = 0;
+
+  vector<int> vec(D);
+  for(int i=0; i<N; i++) {
+    char clase[256];
+    int k;
+    float p;
+
+    if( fscanf(bd, "%255s", clase) != 1 )
+      break;
+    for(int j=0; j<D; j++)
+      if( fscanf(bd, "%d", &vec[j]) != 1 )
+	vec[j] = 255;
+
+    mlp.classify(&vec[0], 1, &k, &p);
+    if( k >= 0 && mlp.keyClass(clase) == k )
+      ok++;
+  }
+  fclose(bd);
+  fclose(tp);
+  printf("Training accuracy: %.4f (%d samples)\n", N ? (double)ok/N : 0.0, N);
+
+  FILE *fd = fopen(argv[optind+2], "w");
+  if( !fd ) {
+    fprintf(stderr, "Error writing model file '%s'\n", argv[optind+2]);
+    return -1;
+  }
+  mlp.save(fd);
+  fclose(fd);
+
+  return 0;
+}
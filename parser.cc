@@ -18,35 +18,164 @@
 
 #include <cstdio>
 #include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <unistd.h>
 #include "grammar.h"
 
 using namespace std;
 
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-p] [-t threads] [-r height] [-n] [-b method] [-a ef] [-c entries] [-C file] grammar file [file ...]\n", prog);
+  fprintf(stderr, "  -p          Page mode: every page of the files is split into\n");
+  fprintf(stderr, "              expression regions that are parsed concurrently\n");
+  fprintf(stderr, "  -t threads  Number of threads used to label the images, to search\n");
+  fprintf(stderr, "              large symbol databases and to parse the regions in\n");
+  fprintf(stderr, "              page mode (default: all CPUs)\n");
+  fprintf(stderr, "  -r height   Reduce the resolution of the images so that symbols\n");
+  fprintf(stderr, "              are about 'height' pixels tall (default: disabled)\n");
+  fprintf(stderr, "  -n          Remove specks (small or faint components) before parsing\n");
+  fprintf(stderr, "  -b method   Binarization of gray images: none (any pixel darker\n");
+  fprintf(stderr, "              than white is ink), otsu or sauvola (default: none)\n");
+  fprintf(stderr, "  -a ef       Approximate classification of the symbols with a beam\n");
+  fprintf(stderr, "              of 'ef' prototypes (default: exact)\n");
+  fprintf(stderr, "  -c entries  Cache the classification of up to 'entries' different\n");
+  fprintf(stderr, "              symbols (default: 4096, 0 disables it)\n");
+  fprintf(stderr, "  -C file     Load the cache from 'file' and save it there at the end\n");
+}
+
+//The cache is reported (on stderr, so that the output does not change)
+//only when it was requested with -c or -C
+void printCacheStats(Grammar *gram, bool requested) {
+  unsigned long hits, lookups;
+  gram->cacheStats(&hits, &lookups);
+  if( requested && lookups > 0 )
+    fprintf(stderr, "Classifier cache: %lu of %lu symbols found (%.1f%%)\n",
+	    hits, lookups, 100.0*hits/lookups);
+}
+
 int main(int argc, char *argv[]) {
-  if( argc != 3 ) {
-    fprintf(stderr, "Usage: %s grammar file\n", argv[0]);
-    return -1;
+  bool pages=false;
+  int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  int refHeight = 0;
+  bool specks=false;
+  int bin = BIN_NONE;
+  int ef = 0;
+  int cacheSize = 4096;
+  char *cacheFile = NULL;
+  bool cacheStats = false;
+  int opt;
+
+  while( (opt = getopt(argc, argv, "pt:r:nb:a:c:C:")) != -1 ) {
+    switch( opt ) {
+    case 'p':
+      pages = true;
+      break;
+    case 't':
+      nthreads = atoi(optarg);
+      break;
+    case 'r':
+      refHeight = atoi(optarg);
+      break;
+    case 'n':
+      specks = true;
+      break;
+    case 'b':
+      if( !strcmp(optarg, "none") )
+	bin = BIN_NONE;
+      else if( !strcmp(optarg, "otsu") )
+	bin = BIN_OTSU;
+      else if( !strcmp(optarg, "sauvola") )
+	bin = BIN_SAUVOLA;
+      else {
+	usage(argv[0]);
+	return -1;
+      }
+      break;
+    case 'a':
+      ef = atoi(optarg);
+      break;
+    case 'c':
+      cacheSize = atoi(optarg);
+      cacheStats = true;
+      break;
+    case 'C':
+      cacheFile = optarg;
+      cacheStats = true;
+      break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
   }
 
-  //Check file
-  FILE *fpars = fopen(argv[2], "r");
-  if( !fpars ) {
-    fprintf(stderr, "Error loading file '%s'\n", argv[2]);
+  if( argc-optind < 2 || (!pages && argc-optind != 2) ) {
+    usage(argv[0]);
     return -1;
   }
-  fclose(fpars);
+
+  //Check files
+  for(int i=optind+1; i<argc; i++) {
+    FILE *fpars = fopen(argv[i], "r");
+    if( !fpars ) {
+      fprintf(stderr, "Error loading file '%s'\n", argv[i]);
+      return -1;
+    }
+    fclose(fpars);
+  }
+
+  Sample::setThreads(nthreads);
 
   //Load grammar
-  Grammar gram(argv[1]);
-
-  //Load sample
-  Sample m(argv[2]);
-    
-  //Print sample information
-  m.print();
-    
-  //Parse sample
-  gram.parse(&m);
+  Grammar gram(argv[optind]);
+  gram.setANN(ef);
+  gram.setCache(cacheSize, cacheFile);
+
+  //In page mode the regions are already parsed concurrently
+  gram.setThreads(pages ? 1 : nthreads);
+
+  if( !pages ) {
+    //Load sample
+    Sample m(argv[optind+1], refHeight, bin);
+
+    if( specks )
+      m.despeckle(0.5, 0.25, 0.3, 0.15, true);
+
+    //Print sample information
+    m.print();
+
+    //Parse sample
+    gram.parse(&m);
+    printCacheStats(&gram, cacheStats);
+    gram.saveCache();
+
+    return 0;
+  }
+
+  //Page mode: one line per expression region
+  for(int i=optind+1; i<argc; i++) {
+    vector<Sample *> pg;
+    Sample::loadPages(argv[i], &pg, refHeight, bin);
+
+    for(int p=0; p<(int)pg.size(); p++) {
+      if( specks ) {
+	int ns = pg[p]->despeckle();
+	if( ns > 0 )
+	  fprintf(stderr, "%s %d: %d specks removed\n", argv[i], p, ns);
+      }
+
+      vector<ParseResult> res = gram.recognizePage(pg[p], nthreads);
+
+      for(int r=0; r<(int)res.size(); r++)
+	printf("%s %d %d_%d_%d_%d LaTeX: %s\n", argv[i], res[r].page,
+	       res[r].rx, res[r].ry, res[r].rs, res[r].rt, res[r].latex.c_str());
+
+      delete pg[p];
+    }
+  }
+
+  printCacheStats(&gram, cacheStats);
+  gram.saveCache();
 
   return 0;
 }
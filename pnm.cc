@@ -0,0 +1,176 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "pnm.h"
+
+using namespace std;
+
+unsigned char *newPixels(int X, int Y, int *stride) {
+  void *pix;
+
+  *stride = (X+15) & ~15;
+  if( posix_memalign(&pix, 16, (size_t)(*stride)*Y + 16) ) {
+    fprintf(stderr, "Error allocating image of %d x %d pixels\n", X, Y);
+    exit(-1);
+  }
+
+  return (unsigned char *)pix;
+}
+
+void freePixels(unsigned char *pix) {
+  free(pix);
+}
+
+//Read the next number of the PNM header skipping comments
+static bool headerInt(const unsigned char *buf, size_t len, size_t *p, int *v) {
+  while( *p < len ) {
+    if( buf[*p] == '#' )
+      while( *p < len && buf[*p] != '\n' )
+	(*p)++;
+    else if( buf[*p]==' ' || buf[*p]=='\t' || buf[*p]=='\n' || buf[*p]=='\r' )
+      (*p)++;
+    else
+      break;
+  }
+
+  if( *p >= len || buf[*p] < '0' || buf[*p] > '9' )
+    return false;
+
+  *v = 0;
+  while( *p < len && buf[*p] >= '0' && buf[*p] <= '9' )
+    *v = *v*10 + buf[(*p)++] - '0';
+
+  return true;
+}
+
+unsigned char *loadPNM(const char *path, int *X, int *Y, int *stride) {
+  int fd = open(path, O_RDONLY);
+  if( fd < 0 )
+    return NULL;
+
+  struct stat st;
+  if( fstat(fd, &st) || st.st_size < 3 ) {
+    close(fd);
+    return NULL;
+  }
+
+  //Check the magic number before mapping the file
+  char magic[2];
+  if( read(fd, magic, 2) != 2 || magic[0] != 'P'
+      || (magic[1] != '4' && magic[1] != '5') ) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t len = st.st_size;
+  const unsigned char *buf = (const unsigned char *)mmap(NULL, len, PROT_READ,
+							   MAP_PRIVATE, fd, 0);
+  close(fd);
+  if( buf == MAP_FAILED )
+    return NULL;
+
+  size_t p=2;
+  int maxval=1;
+  bool pbm = magic[1]=='4';
+  if( !headerInt(buf, len, &p, X) || !headerInt(buf, len, &p, Y)
+      || (!pbm && !headerInt(buf, len, &p, &maxval))
+      || *X <= 0 || *Y <= 0 || maxval <= 0 || maxval > 65535 ) {
+    fprintf(stderr, "Error: Invalid PNM header in '%s'\n", path);
+    exit(-1);
+  }
+  p++; //Single whitespace before the raster
+
+  int bpp = maxval > 255 ? 2 : 1;
+  size_t rowLen = pbm ? (*X+7)/8 : (size_t)(*X)*bpp;
+  if( p + rowLen*(*Y) > len ) {
+    fprintf(stderr, "Error: Truncated PNM file '%s'\n", path);
+    exit(-1);
+  }
+
+  unsigned char *pix = newPixels(*X, *Y, stride);
+  const unsigned char *src = buf + p;
+
+  for(int y=0; y<*Y; y++, src+=rowLen) {
+    unsigned char *row = pix + (size_t)y*(*stride);
+
+    if( pbm ) { //Bit 1 is black
+      for(int x=0; x<*X; x++)
+	row[x] = (src[x>>3] >> (7 - (x&7))) & 1 ? 0 : 255;
+    }
+    else if( bpp == 2 ) { //16-bit big endian samples
+      for(int x=0; x<*X; x++)
+	row[x] = ((src[2*x]<<8 | src[2*x+1]) * 255) / maxval;
+    }
+    else if( maxval == 255 )
+      memcpy(row, src, *X);
+    else {
+      for(int x=0; x<*X; x++)
+	row[x] = (src[x] * 255) / maxval;
+    }
+  }
+
+  munmap((void *)buf, len);
+
+  return pix;
+}
+
+int nextPixel(const unsigned char *row, int x, int X, bool ink) {
+#ifdef __SSE2__
+  //Compare 16 pixels at a time against the background value
+  const __m128i white = _mm_set1_epi8((char)255);
+  for(; x+16 <= X; x+=16) {
+    int m = _mm_movemask_epi8( _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(row+x)),
+					      white) );
+    if( ink ) m ^= 0xFFFF;
+    if( m )
+      return x + __builtin_ctz(m);
+  }
+#endif
+
+  for(; x<X; x++)
+    if( (row[x] < 255) == ink )
+      return x;
+
+  return X;
+}
+
+int nextBit(const unsigned char *row, int x, int X, bool ink) {
+  //Bytes without any pixel of the requested kind are skipped at once
+  unsigned char skip = ink ? 0 : 255;
+
+  while( x < X ) {
+    if( (x&7)==0 && row[x>>3]==skip )
+      x += 8;
+    else if( (((row[x>>3] >> (7 - (x&7))) & 1) != 0) == ink )
+      return x;
+    else
+      x++;
+  }
+
+  return X;
+}
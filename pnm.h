@@ -0,0 +1,38 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#ifndef _PNM_
+#define _PNM_
+
+//Contiguous 8-bit gray buffer of X x Y pixels whose rows are aligned
+//to 16 bytes. The row length in bytes is returned in 'stride'
+unsigned char *newPixels(int X, int Y, int *stride);
+void freePixels(unsigned char *pix);
+
+//Load a binary PGM (P5) or PBM (P4) file into a new pixel buffer.
+//It returns NULL if the file is not in one of these formats
+unsigned char *loadPNM(const char *path, int *X, int *Y, int *stride);
+
+//First column >= x of the row whose pixel is foreground (ink=true)
+//or background (ink=false), or X if there is none
+int nextPixel(const unsigned char *row, int x, int X, bool ink);
+
+//Same for 1-bit rows (most significant bit first, 1 is ink)
+int nextBit(const unsigned char *row, int x, int X, bool ink);
+
+#endif
@@ -21,6 +21,7 @@
 #include <cmath>
 #include <cfloat>
 #include "production.h"
+#include "sample.h"
 
 #define OVERLAP 0.85
 
@@ -114,6 +115,13 @@ float ProductionB::overlap(CYKcell *a, CYKcell *b) {
 
 
 void ProductionB::printOut(CYKcell *cell) {
+  string out;
+  getOut(cell, &out);
+  printf("%s", out.c_str());
+}
+
+//LaTeX output of the hypothesis 'cell' appended to 'out'
+void ProductionB::getOut(CYKcell *cell, string *out) {
   if( outStr ) {
     int pd1 = check(outStr, (char*)"$1");
     int pd2 = check(outStr, (char*)"$2");
@@ -121,69 +129,71 @@ void ProductionB::printOut(CYKcell *cell) {
     int i=0;
     if( pd2 >= 0 && pd1 >= 0 && pd2 < pd1 ) {
       while( outStr[i]!='$' || outStr[i+1] != '2') {
-	putchar(outStr[i]);
+	out->push_back(outStr[i]);
 	i++;
       }
       i+=2;
       
       if( cell->ntsims[S]->hd->ntsims[B]->clase < 0 )
-	cell->ntsims[S]->hd->ntsims[B]->prod->printOut(cell->ntsims[S]->hd);
+	cell->ntsims[S]->hd->ntsims[B]->prod->getOut(cell->ntsims[S]->hd, out);
       else
-	printf("%s", cell->ntsims[S]->hd->ntsims[B]->pt->getTeX(cell->ntsims[S]->hd->ntsims[B]->clase));
+	out->append(cell->ntsims[S]->hd->ntsims[B]->pt->getTeX(cell->ntsims[S]->hd->ntsims[B]->clase));
 
       while( outStr[i]!='$' || outStr[i+1] != '1') {
-	putchar(outStr[i]);
+	out->push_back(outStr[i]);
 	i++;
       }
       i+=2;
 
       if( cell->ntsims[S]->hi->ntsims[A]->clase < 0 )
-	cell->ntsims[S]->hi->ntsims[A]->prod->printOut(cell->ntsims[S]->hi);
+	cell->ntsims[S]->hi->ntsims[A]->prod->getOut(cell->ntsims[S]->hi, out);
       else
-	printf("%s", cell->ntsims[S]->hi->ntsims[A]->pt->getTeX(cell->ntsims[S]->hi->ntsims[A]->clase));
+	out->append(cell->ntsims[S]->hi->ntsims[A]->pt->getTeX(cell->ntsims[S]->hi->ntsims[A]->clase));
     }
     else {
       if( pd1 >= 0 ) {
 	while( outStr[i]!='$' || outStr[i+1] != '1') {
-	  putchar(outStr[i]);
+	  out->push_back(outStr[i]);
 	  i++;
 	}
 	i+=2;
 	
 	if( cell->ntsims[S]->hi->ntsims[A]->clase < 0 )
-	  cell->ntsims[S]->hi->ntsims[A]->prod->printOut(cell->ntsims[S]->hi);
+	  cell->ntsims[S]->hi->ntsims[A]->prod->getOut(cell->ntsims[S]->hi, out);
 	else
-	  printf("%s", cell->ntsims[S]->hi->ntsims[A]->pt->getTeX(cell->ntsims[S]->hi->ntsims[A]->clase));
+	  out->append(cell->ntsims[S]->hi->ntsims[A]->pt->getTeX(cell->ntsims[S]->hi->ntsims[A]->clase));
       }
       if( pd2 >= 0 ) {
 	while( outStr[i]!='$' || outStr[i+1] != '2') {
-	  putchar(outStr[i]);
+	  out->push_back(outStr[i]);
 	  i++;
 	}
 	i+=2;
 	
 	if( cell->ntsims[S]->hd->ntsims[B]->clase < 0 )
-	  cell->ntsims[S]->hd->ntsims[B]->prod->printOut(cell->ntsims[S]->hd);
+	  cell->ntsims[S]->hd->ntsims[B]->prod->getOut(cell->ntsims[S]->hd, out);
 	else
-	  printf("%s", cell->ntsims[S]->hd->ntsims[B]->pt->getTeX(cell->ntsims[S]->hd->ntsims[B]->clase));
+	  out->append(cell->ntsims[S]->hd->ntsims[B]->pt->getTeX(cell->ntsims[S]->hd->ntsims[B]->clase));
       }
     }
     while( outStr[i] ) {
-      putchar(outStr[i]);
+      out->push_back(outStr[i]);
       i++;
     }
   }
 }
 
 
-void ProductionB::printComps(CYKcell *cell, int sym) {
+void ProductionB::printComps(CYKcell *cell, int sym, Sample *m) {
   if( cell->ntsims[sym]->clase >= 0 ) {
-    printf("#%d_%d_%d_%d %s\n", cell->x, cell->y, cell->s, cell->t, 
+    int x=cell->x, y=cell->y, s=cell->s, t=cell->t;
+    m->toImage(&x, &y, &s, &t);
+    printf("#%d_%d_%d_%d %s\n", x, y, s, t,
 	cell->ntsims[sym]->pt->getTeX(cell->ntsims[sym]->clase));
   }
   else {
-    cell->ntsims[sym]->hi->ntsims[A]->prod->printComps(cell->ntsims[S]->hi, A);
-    cell->ntsims[sym]->hd->ntsims[B]->prod->printComps(cell->ntsims[S]->hd, B);
+    cell->ntsims[sym]->hi->ntsims[A]->prod->printComps(cell->ntsims[S]->hi, A, m);
+    cell->ntsims[sym]->hd->ntsims[B]->prod->printComps(cell->ntsims[S]->hd, B, m);
   }
 }
 
@@ -21,6 +21,9 @@
 
 class CYKcell;
 class recNN;
+class Sample;
+
+#include <string>
 
 #include "cyktable.h"
 #include "recNN.h"
@@ -45,7 +48,8 @@ class ProductionB{
   void getData(int *s, int *a, int *b);
   float overlap(CYKcell *a, CYKcell *b);
   void printOut(CYKcell *cell);
-  void printComps(CYKcell *cell, int sym);
+  void getOut(CYKcell *cell, string *out);
+  void printComps(CYKcell *cell, int sym, Sample *m);
   void setMerges(bool a, bool b, bool c);
 
   //Pure virtual functions
@@ -0,0 +1,397 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <algorithm>
+#include "recMLP.h"
+
+//Samples of every step of the training, momentum of the steps and
+//weight decay (L2 regularization, not applied to the biases)
+#define MLP_BATCH    32
+#define MLP_MOMENTUM 0.9
+#define MLP_DECAY    1e-4
+
+//Distances to the classes are learned up to this value (in the scale of
+//distPosterior, a posterior of about 0.007)
+#define MLP_MAXDIST 5.0f
+
+//Least weight of the error of a class in the training
+#define MLP_WFLOOR 0.1f
+
+static inline unsigned int nextRand(unsigned int *s) {
+  *s = *s*1103515245u + 12345u;
+  return *s >> 8;
+}
+
+//Uniform value in [-a,a)
+static inline float uniform(unsigned int *s, double a) {
+  return (nextRand(s)/8388608.0 - 1)*a;
+}
+
+static inline float dot(const float *a, const float *b, int n) {
+  float d=0;
+  for(int i=0; i<n; i++)
+    d += a[i]*b[i];
+  return d;
+}
+
+//Squared norm of a vector of D values in the scale of distPosterior
+static float norm(const unsigned char *v, int D) {
+  int n=0;
+  for(int j=0; j<D; j++)
+    n += v[j]*v[j];
+  return n / DIST_SCALE;
+}
+
+//Read a model written by save
+recMLP::recMLP(FILE *fd, FILE *tp) {
+  char magic[8];
+  int fD, fC;
+
+  if( fscanf(fd, "%7s %d %d %d", magic, &fD, &H, &fC) != 4 || strcmp(magic, "MLP")
+      || fD != D || H < 0 || fC <= 0 ) {
+    fprintf(stderr, "recMLP: Invalid model file\n");
+    exit(-1);
+  }
+
+  for(int c=0; c<fC; c++) {
+    char clase[256];
+    if( fscanf(fd, "%255s", clase) != 1 || addClass(clase) != c ) {
+      fprintf(stderr, "recMLP: Invalid class %d in model file\n", c);
+      exit(-1);
+    }
+  }
+
+  alloc();
+
+  bool ok = true;
+  for(int u=0; u<H && ok; u++) {
+    for(int j=0; j<D && ok; j++)
+      ok = fscanf(fd, "%f", &W1[(size_t)u*DF + j]) == 1;
+    ok = ok && fscanf(fd, "%f", &b1[u]) == 1;
+  }
+  for(int c=0; c<C && ok; c++) {
+    float *w = W2 + (size_t)c*AF;
+    for(int u=0; u<H && ok; u++)
+      ok = fscanf(fd, "%f", &w[u]) == 1;
+    for(int j=0; j<D && ok; j++)
+      ok = fscanf(fd, "%f", &w[HF+j]) == 1;
+    ok = ok && fscanf(fd, "%f", &b2[c]) == 1;
+  }
+  if( !ok ) {
+    fprintf(stderr, "recMLP: Error reading the weights of the model\n");
+    exit(-1);
+  }
+
+  loadTypes(tp);
+}
+
+//Train a model with H hidden units on a database of samples (see
+//SymClassifier::readSamples), with 'epochs' passes of stochastic
+//gradient descent starting with the learning rate 'rate'
+recMLP::recMLP(FILE *bd, FILE *tp, int H, int epochs, float rate, unsigned int seed) {
+  vector<unsigned char> raw;
+  vector<int> lab;
+
+  readSamples(bd, &raw, &lab);
+  this->H = max(H, 0);
+  alloc();
+  train(raw, lab, epochs, rate, seed);
+
+  loadTypes(tp);
+}
+
+recMLP::~recMLP() {
+  freeVectors((unsigned char *)W1);
+  freeVectors((unsigned char *)W2);
+  delete[] b1;
+  delete[] b2;
+}
+
+//Weights padded with zeros
+void recMLP::alloc() {
+  DF = (D+7) & ~7;
+  HF = (H+7) & ~7;
+  AF = HF + DF;
+
+  W1 = (float *)newVectors((size_t)H*DF*sizeof(float));
+  W2 = (float *)newVectors((size_t)C*AF*sizeof(float));
+  b1 = new float[max(H,1)];
+  b2 = new float[max(C,1)];
+  for(int u=0; u<H; u++)
+    b1[u] = 0;
+  for(int c=0; c<C; c++)
+    b2[c] = 0;
+
+  dot4 = dot4FloatKernel();
+}
+
+void recMLP::save(FILE *fd) {
+  fprintf(fd, "MLP %d %d %d\n", D, H, C);
+  for(int c=0; c<C; c++)
+    fprintf(fd, "%s%c", key2cl[c].c_str(), c+1 < C ? ' ' : '\n');
+
+  for(int u=0; u<H; u++) {
+    for(int j=0; j<D; j++)
+      fprintf(fd, "%.8g ", W1[(size_t)u*DF + j]);
+    fprintf(fd, "%.8g\n", b1[u]);
+  }
+  for(int c=0; c<C; c++) {
+    float *w = W2 + (size_t)c*AF;
+    for(int u=0; u<H; u++)
+      fprintf(fd, "%.8g ", w[u]);
+    for(int j=0; j<D; j++)
+      fprintf(fd, "%.8g ", w[HF+j]);
+    fprintf(fd, "%.8g\n", b2[c]);
+  }
+}
+
+//Inputs of the network from a vector, clamped to bytes in v
+void recMLP::input(const int *vec, float *x, unsigned char *v) {
+  for(int j=0; j<D; j++) {
+    v[j] = vec[j] < 0 ? 0 : (vec[j] > 255 ? 255 : vec[j]);
+    x[j] = (255 - v[j]) / 255.0f;
+  }
+}
+
+//Hidden units of the M inputs of x (rows of DF floats, M multiple of 4)
+//followed by the inputs, in rows of AF floats of a
+void recMLP::hidden(const float *x, int M, float *a) {
+  float d[4];
+
+  for(int m=0; m<M; m+=4)
+    for(int u=0; u<H; u++) {
+      dot4(x + (size_t)m*DF, DF, W1 + (size_t)u*DF, DF, d);
+      for(int t=0; t<4; t++) {
+	float s = d[t] + b1[u];
+	a[(size_t)(m+t)*AF + u] = s > 0 ? s : 0;
+      }
+    }
+
+  for(int m=0; m<M; m++)
+    memcpy(a + (size_t)m*AF + HF, x + (size_t)m*DF, DF*sizeof(float));
+}
+
+//Outputs of the M rows of a, the distances to the classes minus the
+//norm of the vector, rows of C floats in z
+void recMLP::logits(const float *a, int M, float *z) {
+  float d[4];
+
+  for(int m=0; m<M; m+=4)
+    for(int c=0; c<C; c++) {
+      dot4(a + (size_t)m*AF, AF, W2 + (size_t)c*AF, AF, d);
+      for(int t=0; t<4; t++)
+	z[(size_t)(m+t)*C + c] = d[t] + b2[c];
+    }
+}
+
+void recMLP::classify(int *vec, int nbest, int *k, float *p) {
+  classifyBatch(vec, 1, nbest, k, p);
+}
+
+//Every layer is computed for groups of 4 vectors, so that the weights
+//are read once for all of them
+void recMLP::classifyBatch(int *vecs, int M, int nbest, int *k, float *p) {
+  int MP = (M+3) & ~3;
+  float *x = (float *)newVectors((size_t)MP*DF*sizeof(float));
+  vector<float> qn(M);
+  vector<unsigned char> v(D);
+  for(int m=0; m<M; m++) {
+    input(vecs + (size_t)m*D, x + (size_t)m*DF, &v[0]);
+    qn[m] = norm(&v[0], D);
+  }
+
+  float *a = x;
+  if( H > 0 ) {
+    a = (float *)newVectors((size_t)MP*AF*sizeof(float));
+    hidden(x, MP, a);
+  }
+
+  vector<float> z((size_t)MP*C);
+  logits(a, MP, &z[0]);
+
+  for(int m=0; m<M; m++) {
+    float *zm = &z[(size_t)m*C], *pm = p + (size_t)m*nbest;
+    int *km = k + (size_t)m*nbest;
+
+    for(int i=0; i<nbest; i++) {
+      km[i] = -1;
+      pm[i] = 0;
+    }
+
+    //Increasing order, the best class last
+    for(int c=0; c<C; c++) {
+      float pc = distPosterior(max(qn[m] + zm[c], 0.0f)*DIST_SCALE);
+      if( pc <= pm[0] )
+	continue;
+
+      pm[0] = pc;
+      km[0] = c;
+      for(int i=1; i<nbest && pm[i-1] > pm[i]; i++) {
+	swap(pm[i], pm[i-1]);
+	swap(km[i], km[i-1]);
+      }
+    }
+  }
+
+  if( a != x )
+    freeVectors((unsigned char *)a);
+  freeVectors((unsigned char *)x);
+}
+
+//Distances of the samples to the nearest sample of every class, from
+//which distPosterior gives the posteriors of the nearest neighbour
+//classifier, minus the squared norm of the sample (in the scale of
+//distPosterior, rows of C values). That is the minimum of the linear
+//functions |p|^2 - 2 x.p of the samples p of the class
+static void targets(vector<unsigned char> &raw, vector<int> &lab, int D, int C,
+		    vector<float> *Y) {
+  int N = lab.size();
+  int DP = (D + DIST_ALIGN-1) & ~(DIST_ALIGN-1);
+  unsigned char *v = newVectors((size_t)N*DP);
+  distFunc dist = distKernel();
+
+  for(int i=0; i<N; i++)
+    memcpy(v + (size_t)i*DP, &raw[(size_t)i*D], D);
+
+  Y->resize((size_t)N*C);
+  vector<int> best(C);
+  for(int i=0; i<N; i++) {
+    fill(best.begin(), best.end(), INT_MAX);
+    for(int j=0; j<N; j++)
+      best[lab[j]] = min(best[lab[j]], dist(v + (size_t)i*DP, v + (size_t)j*DP, DP));
+
+    float n = norm(&raw[(size_t)i*D], D);
+    for(int c=0; c<C; c++)
+      (*Y)[(size_t)i*C + c] = min(best[c]/DIST_SCALE, MLP_MAXDIST) - n;
+  }
+
+  freeVectors(v);
+}
+
+//Minimize the weighted squared error of the outputs and the distances to
+//the classes (minus the norm) by stochastic gradient descent with momentum, the learning rate
+//decreasing linearly to 0
+void recMLP::train(vector<unsigned char> &raw, vector<int> &lab, int epochs, float rate,
+		   unsigned int seed) {
+  int N = lab.size();
+
+  vector<float> X((size_t)N*DF, 0), Y;
+  for(int i=0; i<N; i++)
+    for(int j=0; j<D; j++)
+      X[(size_t)i*DF + j] = (255 - raw[(size_t)i*D + j]) / 255.0f;
+  targets(raw, lab, D, C, &Y);
+
+  //Errors weighted by the posterior of the class plus MLP_WFLOOR, so the
+  //order of the nearest classes matters more than the distance to far ones
+  vector<float> WY(Y.size());
+  for(int i=0; i<N; i++) {
+    float n = norm(&raw[(size_t)i*D], D);
+    for(int c=0; c<C; c++)
+      WY[(size_t)i*C + c] = MLP_WFLOOR + distPosterior((Y[(size_t)i*C + c] + n)*DIST_SCALE);
+  }
+
+  //Initial weights uniform in +-sqrt(6/inputs), those of the inputs to
+  //the outputs start at 0
+  for(int u=0; u<H; u++)
+    for(int j=0; j<D; j++)
+      W1[(size_t)u*DF + j] = uniform(&seed, sqrt(6.0/D));
+  for(int c=0; c<C; c++)
+    for(int u=0; u<H; u++)
+      W2[(size_t)c*AF + u] = uniform(&seed, sqrt(6.0/H));
+
+  //Gradients and velocities of the weights
+  vector<float> g1((size_t)H*DF), gb1(H), g2((size_t)C*AF), gb2(C);
+  vector<float> v1((size_t)H*DF, 0), vb1(H, 0), v2((size_t)C*AF, 0), vb2(C, 0);
+  vector<float> a(AF, 0), z(C), dh(H);
+
+  vector<int> order(N);
+  for(int i=0; i<N; i++)
+    order[i] = i;
+
+  for(int e=0; e<epochs; e++) {
+    float lr = rate * (1 - (float)e/epochs);
+
+    for(int i=N-1; i>0; i--)
+      swap(order[i], order[nextRand(&seed) % (i+1)]);
+
+    for(int b0=0; b0<N; b0+=MLP_BATCH) {
+      int nb = min(MLP_BATCH, N-b0);
+
+      fill(g1.begin(), g1.end(), 0);
+      fill(gb1.begin(), gb1.end(), 0);
+      fill(g2.begin(), g2.end(), 0);
+      fill(gb2.begin(), gb2.end(), 0);
+
+      for(int s=b0; s<b0+nb; s++) {
+	const float *x = &X[(size_t)order[s]*DF];
+	const float *y = &Y[(size_t)order[s]*C], *wy = &WY[(size_t)order[s]*C];
+
+	for(int u=0; u<H; u++) {
+	  float v = b1[u] + dot(W1 + (size_t)u*DF, x, D);
+	  a[u] = v > 0 ? v : 0;
+	}
+	memcpy(&a[HF], x, DF*sizeof(float));
+
+	//Gradient of the squared error: (output - target) * weight
+	for(int c=0; c<C; c++)
+	  z[c] = (b2[c] + dot(W2 + (size_t)c*AF, &a[0], AF) - y[c]) * wy[c];
+
+	for(int u=0; u<H; u++)
+	  dh[u] = 0;
+	for(int c=0; c<C; c++) {
+	  float *w = W2 + (size_t)c*AF, *g = &g2[(size_t)c*AF];
+	  gb2[c] += z[c];
+	  for(int j=0; j<AF; j++)
+	    g[j] += z[c]*a[j];
+	  for(int u=0; u<H; u++)
+	    dh[u] += z[c]*w[u];
+	}
+
+	for(int u=0; u<H; u++) {
+	  if( a[u] <= 0 )
+	    continue;
+	  float *g = &g1[(size_t)u*DF];
+	  gb1[u] += dh[u];
+	  for(int j=0; j<D; j++)
+	    g[j] += dh[u]*x[j];
+	}
+      }
+
+      for(size_t i=0; i<g1.size(); i++) {
+	v1[i] = MLP_MOMENTUM*v1[i] - lr*(g1[i]/nb + MLP_DECAY*W1[i]);
+	W1[i] += v1[i];
+      }
+      for(int u=0; u<H; u++) {
+	vb1[u] = MLP_MOMENTUM*vb1[u] - lr*gb1[u]/nb;
+	b1[u] += vb1[u];
+      }
+      for(size_t i=0; i<g2.size(); i++) {
+	v2[i] = MLP_MOMENTUM*v2[i] - lr*(g2[i]/nb + MLP_DECAY*W2[i]);
+	W2[i] += v2[i];
+      }
+      for(int c=0; c<C; c++) {
+	vb2[c] = MLP_MOMENTUM*vb2[c] - lr*gb2[c]/nb;
+	b2[c] += vb2[c];
+      }
+    }
+  }
+}
@@ -0,0 +1,63 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#ifndef _RECMLP_
+#define _RECMLP_
+
+#include <cstdio>
+#include <vector>
+
+#include "symclass.h"
+#include "distance.h"
+
+using namespace std;
+
+//Multilayer perceptron classifier. The inputs are the D values as ink
+//intensities (255-v)/255, followed by a hidden layer of H rectified
+//units (none if H is 0: a linear model) and an output for every class
+//connected to both the hidden units and the inputs.
+//Added to the norm of the vector, they are trained to give the distance
+//to the nearest sample of every class, so its posteriors are those of the
+//nearest neighbour classifier (recNN) of its samples, in the same scale,
+//but its cost does not depend on the number of samples
+class recMLP : public SymClassifier{
+  int H;      //Hidden units
+  int DF, HF; //D and H padded to a multiple of 8 floats
+  int AF;     //HF+DF, hidden units and inputs of the outputs
+  float *W1, *b1; //H rows of DF weights and biases
+  float *W2, *b2; //C rows of AF weights and biases
+  dot4FloatFunc dot4;
+
+  void alloc();
+  void input(const int *vec, float *x, unsigned char *v);
+  void hidden(const float *x, int M, float *a);
+  void logits(const float *a, int M, float *z);
+  void train(vector<unsigned char> &raw, vector<int> &lab, int epochs, float rate,
+	     unsigned int seed);
+
+ public:
+  recMLP(FILE *fd, FILE *tp);
+  recMLP(FILE *bd, FILE *tp, int H, int epochs, float rate, unsigned int seed=1);
+  ~recMLP();
+
+  void save(FILE *fd);
+  void classify(int *vec, int nbest, int *k, float *p);
+  void classifyBatch(int *vecs, int M, int nbest, int *k, float *p);
+};
+
+#endif
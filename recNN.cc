@@ -18,151 +18,1494 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
 #include <vector>
 #include <map>
+#include <queue>
 #include <climits>
 #include <cfloat>
+#include <algorithm>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "recNN.h"
+#include "clscache.h"
 #include "production.h"
 
+//Classes are visited by distance to their centroid if they have at least
+//this number of prototypes on average, otherwise that is not worth it
+#define CENTROID_MIN 4
+
+//Databases of at least this size are searched with the vantage-point
+//tree, whose leaves have up to VP_LEAF prototypes
+#define VP_MIN  2048
+#define VP_LEAF 16
+
+//Margin of the pruning of the tree for the rounding of square roots
+#define VP_EPS 1e-6
+
+//Principal components are found from about PCA_SAMPLES prototypes with
+//PCA_ITERS orthogonal iterations
+#define PCA_SAMPLES 4096
+#define PCA_ITERS   30
+
+//Margins of the screening for the projections rounded to floats: on the
+//norm of the difference (the vectors have norms below 3825) and relative
+//to the squared norm for the rounding of the sum
+#define PCA_TOL 1e-3
+#define PCA_EPS 1e-4
+
+//Prototypes compared with every group of queries of a batch before the
+//next ones, so that they stay in the cache (BATCH_TILE rows of DP bytes)
+#define BATCH_TILE 128
+
+//Batches of fewer queries are searched one by one (search), that is
+//faster for a single query and keeps early abandoning, the tree and the
+//PCA screen for it
+#define BATCH_MIN 2
+
+//Databases are split in shards of at least SHARD_MIN prototypes that
+//are searched concurrently (see setThreads)
+#define SHARD_MIN 2048
+
+//Prototypes are also stored sparse if at most this fraction of their
+//values has ink, below it the sparse dot product is faster than the
+//vectorized distances (anti-aliased glyphs have about half of them)
+#define SPARSE_DENSITY 0.06
+
+//Compiled databases (see save) start with BD_MAGIC and the version of
+//their layout, BD_VERSION, that changes with the layout or the meaning
+//of the arrays stored (such as the ink of the prototypes)
+#define BD_MAGIC   "PMEBD\n"
+#define BD_VERSION 1
+
+//Header of a compiled database, followed by its sections
+struct bdHeader{
+  char magic[8];
+  int version;
+  int nodeSize; //sizeof(vpnode), the byte order and layout of the machine
+  int D, DP, N, C;
+  int nodes;    //Nodes of the tree
+  int sparse, nz;
+  float density;
+  unsigned int tag;
+  int names;    //Bytes of the class names
+};
+
+//Sections of a compiled database, in this order, every one aligned to
+//DIST_ALIGN bytes
+enum {BD_PERM, BD_PROTO, BD_LABEL, BD_ORIG, BD_PNORM, BD_CMEMBER, BD_CFIRST,
+      BD_CENT, BD_TREE, BD_TYPE, BD_NZFIRST, BD_NZCOL, BD_NZVAL, BD_NAMES, BD_SECTIONS};
+
+//Offsets and lengths of the sections of a compiled database, returns
+//its size
+static size_t bdLayout(const bdHeader *h, size_t *ofs, size_t *len) {
+  len[BD_PERM] = h->D*sizeof(int);
+  len[BD_PROTO] = (size_t)h->N*h->DP;
+  len[BD_LABEL] = len[BD_ORIG] = len[BD_PNORM] = len[BD_CMEMBER] = h->N*sizeof(int);
+  len[BD_CFIRST] = (h->C+1)*sizeof(int);
+  len[BD_CENT] = (size_t)h->C*h->DP;
+  len[BD_TREE] = (size_t)h->nodes*sizeof(vpnode);
+  len[BD_TYPE] = h->C*sizeof(int);
+  len[BD_NZFIRST] = h->sparse ? (h->N+1)*sizeof(int) : 0;
+  len[BD_NZCOL] = len[BD_NZVAL] = h->sparse ? h->nz : 0;
+  len[BD_NAMES] = h->names;
+
+  size_t o = (sizeof(bdHeader) + DIST_ALIGN-1) & ~(DIST_ALIGN-1);
+  for(int s=0; s<BD_SECTIONS; s++) {
+    ofs[s] = o;
+    o = (o + len[s] + DIST_ALIGN-1) & ~(size_t)(DIST_ALIGN-1);
+  }
+  return o;
+}
+
+//Symbol database of text (see SymClassifier::readSamples) with the types
+//of 'tp', or compiled by save. A compiled database is mapped read-only
+//from the file, so it is loaded at once and processes share its pages,
+//and 'tp' is ignored (the types are those it was compiled with)
 recNN::recNN(FILE *bd, FILE *tp) {
-  //Read number of samples
-  fscanf(bd, "%d", &N); getc(bd);
-  D=225; //15x15
-  C=0;
+  char magic[8];
 
-  data = new int *[N];
+  dist = distKernel();
+  distBound = distBoundKernel();
+  dot4 = dot4Kernel();
+  threads = 1;
+  pool = NULL;
+  work = total = 0;
+  cache = NULL;
+  hits = lookups = 0;
+  mapped = NULL;
+  mapSize = 0;
 
-  for(int i=0; i<N; i++) {
-    data[i] = new int[D+1];
+  if( fread(magic, 1, strlen(BD_MAGIC), bd) == strlen(BD_MAGIC)
+      && !memcmp(magic, BD_MAGIC, strlen(BD_MAGIC)) )
+    loadCompiled(bd);
+  else {
+    rewind(bd);
+    build(bd);
 
-    char clase[256];
-    fscanf(bd, "%s", clase);
+    //Load information about symbol types
+    loadTypes(tp);
+  }
 
-    if( cl2key.find(clase) == cl2key.end() ) {
-      cl2key[clase] = C;
-      key2cl.push_back(clase);
+  useTree = N >= VP_MIN;
+  byCentroid = N >= CENTROID_MIN*C;
 
-      data[i][0] = C;
-      C++;
-    }
-    else
-      data[i][0] = cl2key[clase];
+  //The graph is built on demand (see setANN)
+  entry = maxLevel = -1;
+  annEf = annM = annEfc = 0;
+
+  distFloat = distFloatKernel();
+  pcaDims = 0;
+  pcaBasis = pcaMean = NULL;
+  pcaProj = NULL;
+}
+
+//Map the compiled database 'bd'. The arrays are not copied, they point
+//into the mapping
+void recNN::loadCompiled(FILE *bd) {
+  struct stat st;
+  bdHeader h;
+  size_t ofs[BD_SECTIONS], len[BD_SECTIONS];
 
-    for(int j=1; j<=D ; j++)
-      fscanf(bd, "%d", &data[i][j]);
+  if( fstat(fileno(bd), &st) < 0 || st.st_size < (off_t)sizeof(bdHeader) ) {
+    fprintf(stderr, "Error reading compiled symbols database\n");
+    exit(-1);
+  }
+
+  mapSize = st.st_size;
+  mapped = mmap(NULL, mapSize, PROT_READ, MAP_SHARED, fileno(bd), 0);
+  if( mapped == MAP_FAILED ) {
+    fprintf(stderr, "Error mapping compiled symbols database\n");
+    exit(-1);
+  }
+
+  memcpy(&h, mapped, sizeof(bdHeader));
+  if( h.version != BD_VERSION || h.nodeSize != (int)sizeof(vpnode) || h.D != D
+      || h.DP != ((D + DIST_ALIGN-1) & ~(DIST_ALIGN-1)) ) {
+    fprintf(stderr, "Error: compiled symbols database of another version or machine, compile it again\n");
+    exit(-1);
+  }
+  if( h.N < 0 || h.C < 0 || h.nodes < 0 || h.nz < 0 || h.names < 0
+      || bdLayout(&h, ofs, len) != mapSize ) {
+    fprintf(stderr, "Error reading compiled symbols database (truncated?)\n");
+    exit(-1);
+  }
 
-    getc(bd); //Skip the newline character
+  char *base = (char *)mapped;
+  N = h.N;
+  DP = h.DP;
+  tag = h.tag;
+  sparse = h.sparse;
+  density = h.density;
+
+  perm = (int *)(base + ofs[BD_PERM]);
+  proto = (unsigned char *)(base + ofs[BD_PROTO]);
+  label = (int *)(base + ofs[BD_LABEL]);
+  orig = (int *)(base + ofs[BD_ORIG]);
+  pnorm = (int *)(base + ofs[BD_PNORM]);
+  cmember = (int *)(base + ofs[BD_CMEMBER]);
+  cfirst = (int *)(base + ofs[BD_CFIRST]);
+  cent = (unsigned char *)(base + ofs[BD_CENT]);
+  nzFirst = sparse ? (int *)(base + ofs[BD_NZFIRST]) : NULL;
+  nzCol = sparse ? (unsigned char *)(base + ofs[BD_NZCOL]) : NULL;
+  nzVal = sparse ? (unsigned char *)(base + ofs[BD_NZVAL]) : NULL;
+
+  const vpnode *nodes = (const vpnode *)(base + ofs[BD_TREE]);
+  tree.assign(nodes, nodes + h.nodes);
+
+  //Classes by name, in the order of their keys
+  const char *name = base + ofs[BD_NAMES], *end = name + h.names;
+  for(int c=0; c<h.C; c++) {
+    if( name >= end || !memchr(name, 0, end-name) ) {
+      fprintf(stderr, "Error reading compiled symbols database\n");
+      exit(-1);
+    }
+    addClass(name);
+    name += strlen(name)+1;
   }
 
-  //Load information about symbol types
   type = new int[C];
+  memcpy(type, base + ofs[BD_TYPE], min(C, h.C)*sizeof(int));
 
-  char clase[256], T=0, line[256];
-  while( fgets(line, 256, tp) != NULL ) {
-    for(int i=0; line[i] && line[i] != '\n'; i++) {
-      clase[i] = line[i];
-      if( line[i]==' ' ) {
-	clase[i] = 0;
-	T = line[i+1];
-	break;
-      }
+  //Repeated names would make less classes than the labels refer to
+  if( C != h.C || !checkCompiled(h.nodes, h.nz) ) {
+    fprintf(stderr, "Error: compiled symbols database is damaged, compile it again\n");
+    exit(-1);
+  }
+}
+
+//Check that the indices of a mapped database are in range, so that a
+//damaged file is not read out of bounds by the search
+bool recNN::checkCompiled(int nodes, int nz) {
+  vector<char> seen(max(N, D), 0);
+
+  for(int j=0; j<D; j++) {
+    if( perm[j] < 0 || perm[j] >= D || seen[perm[j]] )
+      return false;
+    seen[perm[j]] = 1;
+  }
+
+  seen.assign(seen.size(), 0);
+  for(int i=0; i<N; i++) {
+    if( label[i] < 0 || label[i] >= C || orig[i] < 0 || orig[i] >= N || seen[orig[i]]
+	|| cmember[i] < 0 || cmember[i] >= N )
+      return false;
+    seen[orig[i]] = 1;
+  }
+
+  if( cfirst[0] != 0 || cfirst[C] != N )
+    return false;
+  for(int c=0; c<C; c++)
+    if( cfirst[c] > cfirst[c+1] )
+      return false;
+
+  //Normal, ascendant or descending (see SymClassifier::loadTypes)
+  for(int c=0; c<C; c++)
+    if( type[c] < 0 || type[c] > 2 )
+      return false;
+
+  if( sparse ) {
+    if( nzFirst[0] != 0 || nzFirst[N] != nz )
+      return false;
+    for(int i=0; i<N; i++)
+      if( nzFirst[i] > nzFirst[i+1] )
+	return false;
+    for(int t=0; t<nz; t++)
+      if( nzCol[t] >= D )
+	return false;
+  }
+
+  //Children after their parent (the root is the node 0), so the tree
+  //has no cycles
+  if( (N > 0) != (nodes > 0) )
+    return false;
+  for(int n=0; n<nodes; n++) {
+    const vpnode &nd = tree[n];
+    if( nd.vp < 0 ) {
+      if( nd.in != -1 || nd.out != -1 || nd.first < 0 || nd.n < 0
+	  || nd.first > N - nd.n )
+	return false;
     }
+    else if( nd.vp >= N || nd.in <= n || nd.in >= nodes || nd.out <= n || nd.out >= nodes )
+      return false;
+  }
 
-    if( cl2key.find(clase) == cl2key.end() )
-      continue;
+  return true;
+}
 
-    if( T=='n' )       type[ cl2key[clase] ] = 0; //Normal
-    else if( T=='a' )  type[ cl2key[clase] ] = 1; //Ascendant
-    else if( T=='d' )  type[ cl2key[clase] ] = 2; //Descending
-    else {
-      fprintf(stderr, "recNN: Error loading symbol types\n");      
-      exit(-1);
+//Write the database compiled, to be loaded by the constructor. The file
+//is for machines of the same byte order and version of recNN
+bool recNN::save(FILE *fd) {
+  bdHeader h;
+  size_t ofs[BD_SECTIONS], len[BD_SECTIONS];
+  string names;
+
+  for(int c=0; c<C; c++)
+    names.append(key2cl[c].c_str(), key2cl[c].size()+1);
+
+  memset(&h, 0, sizeof(bdHeader));
+  memcpy(h.magic, BD_MAGIC, strlen(BD_MAGIC));
+  h.version = BD_VERSION;
+  h.nodeSize = sizeof(vpnode);
+  h.D = D;
+  h.DP = DP;
+  h.N = N;
+  h.C = C;
+  h.nodes = tree.size();
+  h.sparse = sparse;
+  h.nz = sparse ? nzFirst[N] : 0;
+  h.density = density;
+  h.tag = tag;
+  h.names = names.size();
+
+  size_t size = bdLayout(&h, ofs, len);
+  const void *data[BD_SECTIONS] = {perm, proto, label, orig, pnorm, cmember, cfirst,
+				   cent, tree.empty() ? NULL : &tree[0], type, nzFirst,
+				   nzCol, nzVal, names.data()};
+
+  //Sections padded with zeros up to the next one
+  vector<char> buf(size, 0);
+  memcpy(&buf[0], &h, sizeof(bdHeader));
+  for(int s=0; s<BD_SECTIONS; s++)
+    if( len[s] > 0 )
+      memcpy(&buf[ofs[s]], data[s], len[s]);
+
+  return fwrite(&buf[0], 1, size, fd) == size;
+}
+
+//Read the text database 'bd' and build the search structures
+void recNN::build(FILE *bd) {
+  vector<unsigned char> raw;
+  vector<int> lab;
+
+  readSamples(bd, &raw, &lab);
+  N = lab.size();
+  DP=(D + DIST_ALIGN-1) & ~(DIST_ALIGN-1);
+
+  //Cached results are only valid for the same database
+  tag = hashBytes(N ? &raw[0] : NULL, raw.size());
+  tag = hashBytes(N ? &lab[0] : NULL, lab.size()*sizeof(int), tag);
+  for(int c=0; c<C; c++)
+    tag = hashBytes(key2cl[c].c_str(), key2cl[c].size()+1, tag);
+
+  //Dimensions with more variance first, so that partial distances grow fast
+  vector< pair<double,int> > var(D);
+  for(int j=0; j<D; j++) {
+    double s=0, ss=0;
+    for(int i=0; i<N; i++) {
+      s += raw[(size_t)i*D + j];
+      ss += raw[(size_t)i*D + j] * raw[(size_t)i*D + j];
+    }
+    var[j] = make_pair(-(ss - s*s/max(N,1)), j);
+  }
+  sort(var.begin(), var.end());
+
+  perm = new int[D];
+  for(int j=0; j<D; j++)
+    perm[j] = var[j].second;
+
+  //Vantage-point tree over the prototypes (as ink) in the file order
+  unsigned char *m = newVectors((size_t)N*DP);
+  for(int i=0; i<N; i++)
+    for(int j=0; j<D; j++)
+      m[(size_t)i*DP + j] = 255 - raw[(size_t)i*D + perm[j]];
+
+  vector<int> it(N), order;
+  for(int i=0; i<N; i++)
+    it[i] = i;
+  if( N > 0 )
+    buildTree(m, it, 0, N, &order);
+
+  //Contiguous matrix of prototypes in the order of the tree, labels apart
+  proto = newVectors((size_t)N*DP);
+  label = new int[N];
+  orig = new int[N];
+  for(int i=0; i<N; i++) {
+    orig[i] = order[i];
+    label[i] = lab[order[i]];
+    memcpy(proto + (size_t)i*DP, m + (size_t)order[i]*DP, DP);
+  }
+  freeVectors(m);
+
+  pnorm = new int[N];
+  for(int i=0; i<N; i++) {
+    pnorm[i] = 0;
+    for(int j=0; j<D; j++)
+      pnorm[i] += proto[(size_t)i*DP + j] * proto[(size_t)i*DP + j];
+  }
+
+  //Sparse prototypes if the measured density of ink is low
+  size_t nz=0;
+  for(size_t i=0; i<(size_t)N*DP; i++)
+    if( proto[i] )
+      nz++;
+  density = N > 0 ? (double)nz/((size_t)N*D) : 0;
+  sparse = N > 0 && density <= SPARSE_DENSITY;
+
+  nzFirst = NULL;
+  nzCol = nzVal = NULL;
+  if( sparse ) {
+    nzFirst = new int[N+1];
+    nzCol = new unsigned char[nz];
+    nzVal = new unsigned char[nz];
+
+    nz=0;
+    for(int i=0; i<N; i++) {
+      nzFirst[i] = nz;
+      for(int j=0; j<D; j++)
+	if( proto[(size_t)i*DP + j] ) {
+	  nzCol[nz] = j;
+	  nzVal[nz++] = proto[(size_t)i*DP + j];
+	}
     }
+    nzFirst[N] = nz;
   }
+
+  //Prototypes and centroid of every class
+  vector< pair<int,int> > byClass(N);
+  for(int i=0; i<N; i++)
+    byClass[i] = make_pair(label[i], orig[i]);
+  sort(byClass.begin(), byClass.end());
+
+  vector<int> pos(N);
+  for(int i=0; i<N; i++)
+    pos[orig[i]] = i;
+
+  cmember = new int[N];
+  cfirst = new int[C+1];
+  for(int i=0, c=0; i<N; i++) {
+    cmember[i] = pos[byClass[i].second];
+    while( c <= byClass[i].first )
+      cfirst[c++] = i;
+  }
+  cfirst[C] = N;
+
+  cent = newVectors((size_t)C*DP);
+  for(int c=0; c<C; c++)
+    for(int j=0; j<D; j++) {
+      int s=0;
+      for(int i=cfirst[c]; i<cfirst[c+1]; i++)
+	s += proto[(size_t)cmember[i]*DP + j];
+      cent[(size_t)c*DP + j] = (s + (cfirst[c+1]-cfirst[c])/2) / (cfirst[c+1]-cfirst[c]);
+    }
 }
 
 recNN::~recNN() {
-  for(int i=0; i<N; i++)
-    delete[] data[i];
-  delete[] data;
-  delete[] type;
+  setThreads(1);
+  delete cache;
+  if( mapped )
+    munmap(mapped, mapSize);
+  else {
+    freeVectors(proto);
+    freeVectors(cent);
+    delete[] label;
+    delete[] orig;
+    delete[] pnorm;
+    delete[] nzFirst;
+    delete[] nzCol;
+    delete[] nzVal;
+    delete[] perm;
+    delete[] cmember;
+    delete[] cfirst;
+  }
+  delete[] pcaBasis;
+  delete[] pcaMean;
+  freeVectors((unsigned char *)pcaProj);
 }
 
 void recNN::print() {
+  vector<int> col(D);
+  for(int j=0; j<D; j++)
+    col[perm[j]] = j;
+
   printf("%d %d %d\n", N, D, C);
   for(int i=0; i<N; i++) {
-    printf("%s ", (key2cl[data[i][0]]).c_str());
-    for(int j=1; j<=D; j++)
-      printf("%d", data[i][j]);
+    printf("%s ", (key2cl[label[i]]).c_str());
+    for(int j=0; j<D; j++)
+      printf("%d", 255 - proto[(size_t)i*DP + col[j]]);
     printf("\n");
   }
 }
 
-void recNN::classify(int *vec, int nbest, int *k, float *p) {
+//Build the subtree of the prototypes it[lo,hi) of the matrix 'm' (rows
+//in the file order) and append them to 'order' as they are stored: the
+//vantage point of a node before its subtrees and the leaves contiguous
+int recNN::buildTree(const unsigned char *m, vector<int> &it, int lo, int hi,
+		     vector<int> *order) {
+  int node = tree.size();
+  tree.push_back(vpnode());
+  vpnode nd = tree[node];
+
+  if( hi-lo <= VP_LEAF ) {
+    nd.vp = nd.in = nd.out = -1;
+    nd.first = order->size();
+    nd.n = hi-lo;
+    order->insert(order->end(), it.begin()+lo, it.begin()+hi);
+    tree[node] = nd;
+    return node;
+  }
+
+  //Vantage point: the farthest prototype from the first one
+  int far=lo, dfar=-1;
+  for(int i=lo; i<hi; i++) {
+    int d = dist(m + (size_t)it[lo]*DP, m + (size_t)it[i]*DP, DP);
+    if( d > dfar ) {
+      dfar = d;
+      far = i;
+    }
+  }
+  swap(it[lo], it[far]);
+  nd.vp = order->size();
+  order->push_back(it[lo]);
+
+  //The nearest half of the prototypes goes to 'in' and the rest to 'out'
+  vector< pair<int,int> > ds;
+  for(int i=lo+1; i<hi; i++)
+    ds.push_back(make_pair(dist(m + (size_t)it[lo]*DP, m + (size_t)it[i]*DP, DP), it[i]));
+  sort(ds.begin(), ds.end());
+
+  int mid = ds.size()/2;
+  for(int i=0; i<(int)ds.size(); i++)
+    it[lo+1+i] = ds[i].second;
+
+  nd.inLo = sqrt((double)ds[0].first);
+  nd.inHi = sqrt((double)ds[mid-1].first);
+  nd.outLo = sqrt((double)ds[mid].first);
+  nd.outHi = sqrt((double)ds.back().first);
+  nd.first = nd.n = 0;
+
+  nd.in = buildTree(m, it, lo+1, lo+1+mid, order);
+  nd.out = buildTree(m, it, lo+1+mid, hi, order);
+  tree[node] = nd;
+
+  return node;
+}
+
+//Prototypes are compared by distance and then by position in the database,
+//so the result does not depend on the order they are visited
+static inline bool keyLess(float d1, int i1, float d2, int i2) {
+  return d1 < d2 || (d1 == d2 && i1 < i2);
+}
+
+//Insert the prototype 'idx' of class 'cls' at distance 'dis' in the
+//n-best list (sorted by decreasing key, one entry per class)
+static void insertNBest(int nbest, int *k, float *p, int *id, int cls, int dis, int idx) {
+  int insp=0;
+  for(int q=0; q<nbest; q++)
+    if( k[q] == cls ) {
+      if( !keyLess(dis, idx, p[q], id[q]) )
+	return;
+      insp=q;
+      break;
+    }
+
+  if( k[insp] != cls && !keyLess(dis, idx, p[0], id[0]) )
+    return;
+
+  p[insp] = dis;
+  k[insp] = cls;
+  id[insp] = idx;
+
+  //Reorder nbest list
+  for(int q=insp+1; q<nbest; q++)
+    if( keyLess(p[q-1], id[q-1], p[q], id[q]) ) {
+      swap(p[q], p[q-1]);
+      swap(k[q], k[q-1]);
+      swap(id[q], id[q-1]);
+    }
+    else break;
+}
+
+//n-best list of the vector with the distances to the classes
+void recNN::search(int *vec, int nbest, int *k, float *p) {
+  int *id = new int[nbest];
   for(int i=0; i<nbest; i++) {
     p[i] = FLT_MAX;
     k[i] = -1;
+    id[i] = INT_MAX;
   }
 
-  for(int i=0; i < N; i++) {
-    int dis=0;
-    for(int j=0; j<D; j++)
-      dis += (vec[j]-data[i][j+1])*(vec[j]-data[i][j+1]);
-  
-    if( dis < p[0] ) {
-      int insp=0;
-      bool insert=true;
-      for(int q=0; q<nbest; q++)
-	if( k[q] == data[i][0] ) {
-	  if( dis >= p[q] )
-	    insert=false;
-	  else
-	    insp=q;
-	  break;
-	}
+  //Query with the layout of the prototypes (as ink)
+  unsigned char *q = newVectors(DP);
+  int qn=0;
+  for(int j=0; j<D; j++) {
+    q[j] = 255 - (vec[perm[j]] < 0 ? 0 : (vec[perm[j]] > 255 ? 255 : vec[perm[j]]));
+    qn += q[j]*q[j];
+  }
+
+  unsigned long w=0;
+  float *qp=NULL;
+  if( pcaDims > 0 && annEf <= 0 ) {
+    qp = (float *)newVectors(pcaStride*sizeof(float));
+    project(q, qp);
+    w += (unsigned long)pcaDims*DP;
+  }
+
+  if( annEf > 0 && entry >= 0 )
+    searchGraph(q, nbest, k, p, id, &w);
+  else if( shards() > 1 )
+    searchShards(q, qp, qn, NULL, 1, nbest, k, p, id, &w);
+  else if( useTree )
+    searchTree(0, q, qp, qn, nbest, k, p, id, &w);
+  else
+    searchLinear(q, qp, qn, nbest, k, p, id, &w);
+
+  freeVectors(q);
+  freeVectors((unsigned char *)qp);
+  delete[] id;
+
+  __sync_fetch_and_add(&work, w);
+  __sync_fetch_and_add(&total, (unsigned long)N*DP);
+}
+
+//Pruning bound: prototypes farther than the worst of the n-best list
+//can not get into it
+static inline int nbestBound(float *p) {
+  return p[0] < INT_MAX ? (int)p[0] : INT_MAX;
+}
+
+//Bound of the n-best list of a shard, lowered to the one shared by all
+//the shards of the query (if any)
+static inline int nbestBound(float *p, volatile int *cap) {
+  int b = nbestBound(p);
+  return cap && *cap < b ? *cap : b;
+}
+
+//Share the bound of a full n-best list: it has nbest classes closer than
+//it, so neither can any prototype beyond it get into the merged list
+static inline void shareBound(float *p, volatile int *cap) {
+  int b = nbestBound(p), c;
+  while( cap && b < (c = *cap) && !__sync_bool_compare_and_swap(cap, c, b) )
+    ;
+}
+
+//Distance of the query 'q' with squared norm 'qn' to the prototype i,
+//abandoned beyond 'bound' like distBound (the values computed are
+//returned in 'len'). Sparse prototypes are compared in full, the dot
+//product with their ink only
+int recNN::protoDist(const unsigned char *q, int qn, int i, int bound, int *len) {
+  if( !sparse )
+    return distBound(q, proto + (size_t)i*DP, DP, bound, len);
+
+  const unsigned char *c = nzCol + nzFirst[i], *v = nzVal + nzFirst[i];
+  int n = nzFirst[i+1] - nzFirst[i], d0=0, d1=0, t=0;
+  for(; t+2 <= n; t+=2) {
+    d0 += q[c[t]] * v[t];
+    d1 += q[c[t+1]] * v[t+1];
+  }
+  if( t < n )
+    d0 += q[c[t]] * v[t];
+
+  *len = n;
+  return qn + pnorm[i] - 2*(d0+d1);
+}
+
+//Search the subtree 'node'. The prototypes of a subtree are at distance
+//at least max(lo-dq, dq-hi) of the query, where dq is the distance of
+//the query to the vantage point, so it is skipped if that is beyond the
+//worst distance of the n-best list (or the bound 'cap' shared by the
+//shards of the query, if lower)
+void recNN::searchTree(int node, const unsigned char *q, const float *qp, int qn,
+		       int nbest, int *k, float *p, int *id, unsigned long *w,
+		       volatile int *cap) {
+  vpnode *nd = &tree[node];
+
+  if( nd->vp < 0 ) {
+    for(int i=nd->first; i<nd->first+nd->n; i++) {
+      int len, bound = nbestBound(p, cap);
+      if( qp && screened(qp, i, bound) ) {
+	*w += pcaDims+1;
+	continue;
+      }
+
+      int dis = protoDist(q, qn, i, bound, &len);
+      *w += len;
+
+      if( dis <= bound ) {
+	insertNBest(nbest, k, p, id, label[i], dis, orig[i]);
+	shareBound(p, cap);
+      }
+    }
+    return;
+  }
+
+  int d2 = dist(q, proto + (size_t)nd->vp*DP, DP);
+  *w += DP;
+  if( d2 <= nbestBound(p, cap) ) {
+    insertNBest(nbest, k, p, id, label[nd->vp], d2, orig[nd->vp]);
+    shareBound(p, cap);
+  }
+
+  //Nearest subtree first
+  double dq = sqrt((double)d2);
+  bool inFirst = 2*dq <= nd->inHi + nd->outLo;
+
+  for(int c=0; c<2; c++) {
+    bool in = (c==0) == inFirst;
+    double lo = in ? nd->inLo : nd->outLo;
+    double hi = in ? nd->inHi : nd->outHi;
+    int b = nbestBound(p, cap);
+    double r = b < INT_MAX ? sqrt((double)b) : HUGE_VAL;
+
+    if( lo - dq > r + VP_EPS || dq - hi > r + VP_EPS )
+      continue;
+
+    searchTree(in ? nd->in : nd->out, q, qp, qn, nbest, k, p, id, w, cap);
+  }
+}
+
+//Linear scan of the prototypes. The classes whose centroid is closer are
+//visited first to tighten the bound
+void recNN::searchLinear(const unsigned char *q, const float *qp, int qn, int nbest,
+			 int *k, float *p, int *id, unsigned long *w) {
+  vector< pair<int,int> > ord(C);
+  for(int c=0; c<C; c++)
+    ord[c] = make_pair(byCentroid ? dist(q, cent + (size_t)c*DP, DP) : 0, c);
+  if( byCentroid ) {
+    sort(ord.begin(), ord.end());
+    *w += (unsigned long)C*DP;
+  }
 
-      if( !insert ) continue;
+  for(int c=0; c<C; c++)
+    for(int j=cfirst[ord[c].second]; j<cfirst[ord[c].second+1]; j++) {
+      //Distances beyond the worst of the n-best are abandoned
+      int i = cmember[j];
+      int len, bound = nbestBound(p);
+      if( qp && screened(qp, i, bound) ) {
+	*w += pcaDims+1;
+	continue;
+      }
+
+      int dis = protoDist(q, qn, i, bound, &len);
+      *w += len;
+
+      if( dis <= bound )
+	insertNBest(nbest, k, p, id, label[i], dis, orig[i]);
+    }
+}
+
+//Compare the M queries 'q' (padded to a multiple of 4) with squared
+//norms 'qnorm' against the prototypes [i0,i1), in tiles of prototypes
+//against groups of 4 queries
+void recNN::scanBatch(const unsigned char *q, const int *qnorm, int M, int nbest,
+		      int *k, float *p, int *id, int i0, int i1) {
+  int MP = (M+3) & ~3;
 
-      p[insp] = dis;
-      k[insp] = data[i][0];
+  for(int t0=i0; t0<i1; t0+=BATCH_TILE) {
+    int t1 = min(t0+BATCH_TILE, i1);
 
-      //Reorder nbest list
-      for(int q=insp+1; q<nbest; q++)
-	if( p[q] > p[q-1] ) {
-	  float aux = p[q];
-	  p[q] = p[q-1];
-	  p[q-1] = aux;
-	  aux = k[q];
-	  k[q] = k[q-1];
-	  k[q-1] = aux;
+    for(int m=0; m<MP; m+=4)
+      for(int i=t0; i<t1; i++) {
+	int d[4];
+	if( sparse ) {
+	  const unsigned char *q0 = q + (size_t)m*DP;
+	  d[0] = d[1] = d[2] = d[3] = 0;
+	  for(int t=nzFirst[i]; t<nzFirst[i+1]; t++) {
+	    int c = nzCol[t], v = nzVal[t];
+	    d[0] += q0[c] * v;
+	    d[1] += q0[DP + c] * v;
+	    d[2] += q0[2*DP + c] * v;
+	    d[3] += q0[3*DP + c] * v;
+	  }
 	}
-	else break;
+	else
+	  dot4(q + (size_t)m*DP, DP, proto + (size_t)i*DP, DP, d);
+
+	for(int t=0; t<4 && m+t<M; t++) {
+	  int dis = qnorm[m+t] + pnorm[i] - 2*d[t];
+	  size_t o = (size_t)(m+t)*nbest;
+	  if( dis <= nbestBound(p+o) )
+	    insertNBest(nbest, k+o, p+o, id+o, label[i], dis, orig[i]);
+	}
+      }
+  }
+}
+
+//n-best lists of the M vectors of D values of 'vecs' (one after the
+//other) at once, the one of the vector m in k[m*nbest] and p[m*nbest].
+//The exact distances are computed as |q|^2 + |p|^2 - 2 q.p in tiles of
+//prototypes against groups of 4 queries, so that the database goes
+//through the cache only once. The result is the same as search
+void recNN::searchBatch(int *vecs, int M, int nbest, int *k, float *p) {
+  //The approximate search and small batches are done query by query
+  if( M < BATCH_MIN || (annEf > 0 && entry >= 0) ) {
+    for(int m=0; m<M; m++)
+      search(vecs + (size_t)m*D, nbest, k + (size_t)m*nbest, p + (size_t)m*nbest);
+    return;
+  }
+
+  //Queries with the layout of the prototypes (as ink), padded to a
+  //multiple of 4
+  int MP = (M+3) & ~3;
+  unsigned char *q = newVectors((size_t)MP*DP);
+  vector<int> qnorm(MP, 0);
+  for(int m=0; m<M; m++)
+    for(int j=0; j<D; j++) {
+      int v = vecs[(size_t)m*D + perm[j]];
+      v = 255 - (v < 0 ? 0 : (v > 255 ? 255 : v));
+      q[(size_t)m*DP + j] = v;
+      qnorm[m] += v*v;
+    }
+
+  vector<int> id((size_t)M*nbest, INT_MAX);
+  for(int i=0; i<M*nbest; i++) {
+    p[i] = FLT_MAX;
+    k[i] = -1;
+  }
+
+  if( shards() > 1 ) {
+    unsigned long w=0;
+    searchShards(q, NULL, 0, &qnorm[0], M, nbest, k, p, &id[0], &w);
+  }
+  else
+    scanBatch(q, &qnorm[0], M, nbest, k, p, &id[0], 0, N);
+
+  freeVectors(q);
+}
+
+//Vector clamped to bytes in its original order, the key of the cache
+void recNN::normalize(const int *vec, unsigned char *v) {
+  for(int j=0; j<D; j++)
+    v[j] = vec[j] < 0 ? 0 : (vec[j] > 255 ? 255 : vec[j]);
+}
 
+//The approximate search depends on the graph, its results are not cached
+bool recNN::cached() {
+  return cache && !(annEf > 0 && entry >= 0);
+}
+
+void recNN::classify(int *vec, int nbest, int *k, float *p) {
+  if( cached() ) {
+    unsigned char *v = new unsigned char[D];
+    normalize(vec, v);
+
+    __sync_fetch_and_add(&lookups, 1);
+    if( cache->lookup(v, nbest, k, p) )
+      __sync_fetch_and_add(&hits, 1);
+    else {
+      search(vec, nbest, k, p);
+      cache->insert(v, nbest, k, p);
     }
+
+    delete[] v;
   }
+  else
+    search(vec, nbest, k, p);
 
   for(int i=0; i<nbest; i++)
-    p[i] = exp(-(double)p[i]/3500000); //Posterior probability aproximation
+    p[i] = distPosterior(p[i]);
+}
+
+//Classify the M vectors of D values of 'vecs' (one after the other) at
+//once, with the n-best lists of the vector m in k[m*nbest] and p[m*nbest].
+//The vectors not found in the cache are searched together, and only the
+//first of those repeated in the batch
+void recNN::classifyBatch(int *vecs, int M, int nbest, int *k, float *p) {
+  if( !cached() ) {
+    searchBatch(vecs, M, nbest, k, p);
+
+    for(int i=0; i<M*nbest; i++)
+      p[i] = distPosterior(p[i]);
+    return;
+  }
+
+  vector<unsigned char> v((size_t)M*D);
+  vector<int> miss, same(M, -1);
+  map<unsigned int,int> first;
+  int found=0;
+
+  for(int m=0; m<M; m++) {
+    unsigned char *vm = &v[(size_t)m*D];
+    normalize(vecs + (size_t)m*D, vm);
+
+    if( cache->lookup(vm, nbest, k + (size_t)m*nbest, p + (size_t)m*nbest) ) {
+      found++;
+      continue;
+    }
+
+    unsigned int key = hashBytes(vm, D);
+    map<unsigned int,int>::iterator it = first.find(key);
+    if( it != first.end() && !memcmp(&v[(size_t)it->second*D], vm, D) ) {
+      same[m] = it->second;
+      found++;
+      continue;
+    }
+
+    if( it == first.end() )
+      first[key] = m;
+    miss.push_back(m);
+  }
+
+  __sync_fetch_and_add(&lookups, (unsigned long)M);
+  __sync_fetch_and_add(&hits, (unsigned long)found);
+
+  if( !miss.empty() ) {
+    int MM = miss.size();
+    vector<int> mv((size_t)MM*D), mk((size_t)MM*nbest);
+    vector<float> mp((size_t)MM*nbest);
+
+    for(int i=0; i<MM; i++)
+      memcpy(&mv[(size_t)i*D], vecs + (size_t)miss[i]*D, D*sizeof(int));
+
+    searchBatch(&mv[0], MM, nbest, &mk[0], &mp[0]);
+
+    for(int i=0; i<MM; i++) {
+      int m = miss[i];
+      memcpy(k + (size_t)m*nbest, &mk[(size_t)i*nbest], nbest*sizeof(int));
+      memcpy(p + (size_t)m*nbest, &mp[(size_t)i*nbest], nbest*sizeof(float));
+      cache->insert(&v[(size_t)m*D], nbest, k + (size_t)m*nbest, p + (size_t)m*nbest);
+    }
+  }
+
+  for(int m=0; m<M; m++)
+    if( same[m] >= 0 ) {
+      memcpy(k + (size_t)m*nbest, k + (size_t)same[m]*nbest, nbest*sizeof(int));
+      memcpy(p + (size_t)m*nbest, p + (size_t)same[m]*nbest, nbest*sizeof(float));
+    }
+
+  for(int i=0; i<M*nbest; i++)
+    p[i] = distPosterior(p[i]);
+}
+
+//Cache of the results of up to 'size' vectors (disabled if size <= 0),
+//loaded from 'file' if it exists and is of this database. The file is
+//written by saveCache
+void recNN::setCache(int size, const char *file) {
+  delete cache;
+  cache = size > 0 ? new ClassCache(size, D) : NULL;
+  cacheFile = file ? file : "";
+  hits = lookups = 0;
+
+  if( !cache || cacheFile.empty() )
+    return;
+
+  FILE *fd = fopen(file, "rb");
+  if( !fd )
+    return;
+  if( !cache->load(fd, tag) )
+    fprintf(stderr, "recNN: Ignoring cache file '%s' (invalid or of another symbol database)\n", file);
+  fclose(fd);
+}
+
+void recNN::saveCache() {
+  if( !cache || cacheFile.empty() )
+    return;
+
+  FILE *fd = fopen(cacheFile.c_str(), "wb");
+  if( !fd || !cache->save(fd, tag) )
+    fprintf(stderr, "recNN: Error writing cache file '%s'\n", cacheFile.c_str());
+  if( fd )
+    fclose(fd);
+}
+
+//Number of vectors classified with the cache and found in it
+void recNN::cacheStats(unsigned long *hits, unsigned long *lookups) {
+  *hits = this->hits;
+  *lookups = this->lookups;
+}
+
+//Shard of the prototypes searched by a thread for M queries, with its own
+//n-best lists: the prototypes [i0,i1) for a batch of queries or the
+//subtree 'node' for a single one, pruned with the bound 'cap' shared by
+//all the subtrees
+struct Shard{
+  recNN *rec;
+  const unsigned char *q;
+  const float *qp;
+  int qn;           //Squared norm of a single query
+  const int *qnorm; //Batch search if not NULL
+  int M, nbest, node, i0, i1;
+  volatile int *cap;
+  vector<int> k, id;
+  vector<float> p;
+  unsigned long w;
+};
+
+void *recNN::shardWorker(void *arg) {
+  Shard *sh = (Shard *)arg;
+
+  if( sh->qnorm )
+    sh->rec->scanBatch(sh->q, sh->qnorm, sh->M, sh->nbest, &sh->k[0], &sh->p[0],
+		       &sh->id[0], sh->i0, sh->i1);
+  else
+    sh->rec->searchTree(sh->node, sh->q, sh->qp, sh->qn, sh->nbest, &sh->k[0], &sh->p[0],
+			&sh->id[0], &sh->w, sh->cap);
+
+  return NULL;
+}
+
+//Threads created once that search the shards of every query, since
+//starting new threads costs as much as searching a small database. The
+//shards of a query are taken in turn by them and the calling thread
+struct ShardPool{
+  pthread_mutex_t lock, busy; //'busy' serializes the queries
+  pthread_cond_t work, done;
+  vector<pthread_t> th;
+  void *(*run)(void *); //Searches a shard
+  Shard *sh;
+  int S, next, pending;
+  bool quit;
+};
+
+//Run the shards sh[next..S) while there are any left (with the lock taken)
+static void takeShards(ShardPool *pool) {
+  while( pool->next < pool->S ) {
+    Shard *sh = &pool->sh[pool->next++];
+    pthread_mutex_unlock(&pool->lock);
+    pool->run(sh);
+    pthread_mutex_lock(&pool->lock);
+    if( --pool->pending == 0 )
+      pthread_cond_signal(&pool->done);
+  }
+}
+
+static void *poolWorker(void *arg) {
+  ShardPool *pool = (ShardPool *)arg;
+
+  pthread_mutex_lock(&pool->lock);
+  while( !pool->quit ) {
+    takeShards(pool);
+    pthread_cond_wait(&pool->work, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+static ShardPool *newPool(int n, void *(*run)(void *)) {
+  ShardPool *pool = new ShardPool;
+  pool->run = run;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_mutex_init(&pool->busy, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->sh = NULL;
+  pool->S = pool->next = pool->pending = 0;
+  pool->quit = false;
+
+  pool->th.resize(n);
+  for(int i=0; i<n; i++)
+    pthread_create(&pool->th[i], NULL, poolWorker, pool);
+
+  return pool;
+}
+
+static void deletePool(ShardPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = true;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  for(int i=0; i<(int)pool->th.size(); i++)
+    pthread_join(pool->th[i], NULL);
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_mutex_destroy(&pool->busy);
+  pthread_cond_destroy(&pool->work);
+  pthread_cond_destroy(&pool->done);
+  delete pool;
+}
+
+//Search the S shards with the threads of the pool and the calling one
+static void runShards(ShardPool *pool, Shard *sh, int S) {
+  pthread_mutex_lock(&pool->busy);
+  pthread_mutex_lock(&pool->lock);
+
+  pool->sh = sh;
+  pool->S = pool->pending = S;
+  pool->next = 0;
+  pthread_cond_broadcast(&pool->work);
+
+  takeShards(pool);
+  while( pool->pending > 0 )
+    pthread_cond_wait(&pool->done, &pool->lock);
+
+  pthread_mutex_unlock(&pool->lock);
+  pthread_mutex_unlock(&pool->busy);
+}
+
+//Number of shards of the database to search it
+int recNN::shards() {
+  return max(1, min(threads, N/SHARD_MIN));
+}
+
+//Search the shards of the database concurrently and merge their n-best
+//lists into k, p and id. Every shard list has the best classes of its
+//prototypes, so the merged list is the one of the whole database. A
+//single query searches subtrees of the tree: the vantage points above
+//them are compared first and seed the lists of all the shards, which
+//share the bound of the best of their lists
+void recNN::searchShards(const unsigned char *q, const float *qp, int qn, const int *qnorm,
+			 int M, int nbest, int *k, float *p, int *id, unsigned long *w) {
+  int S = shards();
+  vector<int> roots;
+  volatile int cap = INT_MAX;
+
+  if( !qnorm ) {
+    roots.push_back(0);
+    while( (int)roots.size()*2 <= S ) {
+      vector<int> next;
+      for(int r=0; r<(int)roots.size(); r++) {
+	vpnode *nd = &tree[roots[r]];
+	if( nd->vp < 0 ) {
+	  next.push_back(roots[r]);
+	  continue;
+	}
+
+	int d = dist(q, proto + (size_t)nd->vp*DP, DP);
+	*w += DP;
+	if( d <= nbestBound(p) )
+	  insertNBest(nbest, k, p, id, label[nd->vp], d, orig[nd->vp]);
+
+	//Nearest subtree first, it is taken first
+	bool inFirst = 2*sqrt((double)d) <= nd->inHi + nd->outLo;
+	next.push_back(inFirst ? nd->in : nd->out);
+	next.push_back(inFirst ? nd->out : nd->in);
+      }
+      roots.swap(next);
+    }
+    S = roots.size();
+    cap = nbestBound(p);
+  }
+
+  Shard *sh = new Shard[S];
+  for(int s=0; s<S; s++) {
+    sh[s].rec = this;
+    sh[s].q = q;
+    sh[s].qp = qp;
+    sh[s].qn = qn;
+    sh[s].qnorm = qnorm;
+    sh[s].M = M;
+    sh[s].nbest = nbest;
+    sh[s].node = qnorm ? -1 : roots[s];
+    sh[s].cap = qnorm ? NULL : &cap;
+    sh[s].i0 = (long)N*s/S;
+    sh[s].i1 = (long)N*(s+1)/S;
+    sh[s].k.assign(k, k + M*nbest);
+    sh[s].id.assign(id, id + M*nbest);
+    sh[s].p.assign(p, p + M*nbest);
+    sh[s].w = 0;
+  }
+
+  runShards(pool, sh, S);
+
+  for(int s=0; s<S; s++) {
+    for(int i=0; i<M*nbest; i++) {
+      int o = i - i%nbest;
+      if( sh[s].k[i] >= 0 )
+	insertNBest(nbest, k+o, p+o, id+o, sh[s].k[i], (int)sh[s].p[i], sh[s].id[i]);
+    }
+    *w += sh[s].w;
+  }
+
+  delete[] sh;
+}
+
+//Number of threads used to search large databases: the prototypes are
+//split in up to 'n' shards of at least SHARD_MIN prototypes
+void recNN::setThreads(int n) {
+  n = max(n, 1);
+  if( n == threads )
+    return;
+
+  if( pool )
+    deletePool(pool);
+  pool = NULL;
+
+  threads = n;
+  if( shards() > 1 )
+    pool = newPool(shards()-1, shardWorker);
+}
+
+//Orthonormalize the P rows of length D of 'b' (Gram-Schmidt, twice for
+//stability). Rows that vanish are replaced by unit vectors
+static void orthonormalize(double *b, int P, int D) {
+  int unit=0;
+
+  for(int r=0; r<P; r++) {
+    double *v = b + (size_t)r*D;
+    double nv=0;
+
+    for(int pass=0; pass<2; pass++)
+      for(int s=0; s<r; s++) {
+	double *u = b + (size_t)s*D, d=0;
+	for(int j=0; j<D; j++)
+	  d += u[j]*v[j];
+	for(int j=0; j<D; j++)
+	  v[j] -= d*u[j];
+      }
+
+    for(int j=0; j<D; j++)
+      nv += v[j]*v[j];
+
+    if( nv < 1e-18 ) {
+      for(int j=0; j<D; j++)
+	v[j] = j == unit ? 1 : 0;
+      unit = (unit+1) % D;
+      r--;
+      continue;
+    }
+
+    nv = sqrt(nv);
+    for(int j=0; j<D; j++)
+      v[j] /= nv;
+  }
+}
+
+//Screen the prototypes with their projection on the first 'dims'
+//principal components (0, the default, disables it). Any orthonormal
+//basis gives a lower bound of the distance, so the search is exact even
+//if the basis is not converged
+void recNN::setPCA(int dims) {
+  delete[] pcaBasis;
+  delete[] pcaMean;
+  freeVectors((unsigned char *)pcaProj);
+  pcaBasis = pcaMean = NULL;
+  pcaProj = NULL;
+
+  pcaDims = N > 0 ? min(max(dims, 0), D) : 0;
+  if( pcaDims == 0 )
+    return;
+
+  pcaMean = new double[D];
+  for(int j=0; j<D; j++) {
+    double s=0;
+    for(int i=0; i<N; i++)
+      s += proto[(size_t)i*DP + j];
+    pcaMean[j] = s/N;
+  }
+
+  //Covariance (upper triangle) of a subset of the prototypes
+  vector<double> cov((size_t)D*D, 0), x(D);
+  int step = max(N/PCA_SAMPLES, 1);
+  for(int i=0; i<N; i+=step) {
+    for(int j=0; j<D; j++)
+      x[j] = proto[(size_t)i*DP + j] - pcaMean[j];
+    for(int a=0; a<D; a++)
+      for(int b=a; b<D; b++)
+	cov[(size_t)a*D + b] += x[a]*x[b];
+  }
+  for(int a=0; a<D; a++)
+    for(int b=0; b<a; b++)
+      cov[(size_t)a*D + b] = cov[(size_t)b*D + a];
+
+  //Orthogonal iteration, starting with the dimensions of more variance
+  pcaBasis = new double[(size_t)pcaDims*D];
+  for(int r=0; r<pcaDims; r++)
+    for(int j=0; j<D; j++)
+      pcaBasis[(size_t)r*D + j] = j == r ? 1 : 0;
+
+  vector<double> z((size_t)pcaDims*D);
+  for(int it=0; it<PCA_ITERS; it++) {
+    for(int r=0; r<pcaDims; r++)
+      for(int a=0; a<D; a++) {
+	double s=0;
+	for(int b=0; b<D; b++)
+	  s += cov[(size_t)a*D + b] * pcaBasis[(size_t)r*D + b];
+	z[(size_t)r*D + a] = s;
+      }
+    orthonormalize(&z[0], pcaDims, D);
+    copy(z.begin(), z.end(), pcaBasis);
+  }
+
+  pcaStride = (pcaDims+1 + 7) & ~7;
+  pcaProj = (float *)newVectors((size_t)N*pcaStride*sizeof(float));
+  for(int i=0; i<N; i++)
+    project(proto + (size_t)i*DP, pcaProj + (size_t)i*pcaStride);
+}
+
+//Coordinates of the vector 'v' in the principal components and the norm
+//of its residual (the part out of them)
+void recNN::project(const unsigned char *v, float *a) {
+  double r2=0;
+  for(int j=0; j<D; j++)
+    r2 += (v[j] - pcaMean[j]) * (v[j] - pcaMean[j]);
+
+  //The rounding of the residual is below 2e-4 (within PCA_TOL)
+  for(int c=0; c<pcaDims; c++) {
+    const double *u = pcaBasis + (size_t)c*D;
+    double s=0;
+    for(int j=0; j<D; j++)
+      s += u[j]*(v[j] - pcaMean[j]);
+    a[c] = s;
+    r2 -= s*s;
+  }
+  a[pcaDims] = sqrt(max(r2, 0.0));
+}
+
+//True if the prototype i is surely farther than 'bound' from the query
+//with projection 'qp': the distance is at least the one between the
+//projections plus the squared difference of the norms of the residuals
+bool recNN::screened(const float *qp, int i, int bound) {
+  float lb = distFloat(qp, pcaProj + (size_t)i*pcaStride, pcaStride);
+  if( lb <= bound )
+    return false;
+
+  double t = sqrt((double)bound) + PCA_TOL;
+  return lb > t*t*(1+PCA_EPS);
+}
+
+//Approximate search with a beam of 'ef' prototypes (0 is exact search) in
+//a graph of up to M links per prototype (2M in the bottom level), built
+//with a beam of 'efc' prototypes. Larger values give better recall
+void recNN::setANN(int ef, int M, int efc) {
+  annEf = ef;
+  if( ef <= 0 || (entry >= 0 && max(M, 2) == annM && max(efc, M) == annEfc) )
+    return;
+
+  annM = max(M, 2);
+  annEfc = max(efc, M);
+  buildGraph();
+}
+
+//Insert the prototypes in the graph. The level of each one is drawn from
+//an exponential distribution with a fixed seed, so the graph does not
+//change between runs
+void recNN::buildGraph() {
+  level.assign(N, 0);
+  lofs.assign(N, 0);
+  adj.clear();
+  entry = maxLevel = -1;
+
+  double mL = 1/log((double)annM);
+  unsigned int seed = 12345;
+  for(int i=0; i<N; i++) {
+    seed = seed*1103515245 + 12345;
+    double u = ((seed >> 8) + 1.0) / 16777217.0;
+    level[i] = (int)(-log(u)*mL);
+    lofs[i] = adj.size();
+    adj.resize(adj.size() + level[i]+1);
+  }
+
+  vector<char> seen(N, 0);
+  for(int i=0; i<N; i++) {
+    const unsigned char *q = proto + (size_t)i*DP;
+    unsigned long w=0;
+
+    if( entry < 0 ) {
+      entry = i;
+      maxLevel = level[i];
+      continue;
+    }
+
+    vector< pair<int,int> > ep(1, make_pair(dist(q, proto + (size_t)entry*DP, DP), entry));
+    for(int l=maxLevel; l>level[i]; l--)
+      searchLayer(q, 1, l, &seen, &ep, &w);
+
+    for(int l=min(level[i], maxLevel); l>=0; l--) {
+      searchLayer(q, annEfc, l, &seen, &ep, &w);
+
+      vector< pair<int,int> > nb(ep);
+      selectLinks(&nb, annM);
+
+      int Mmax = l ? annM : 2*annM;
+      for(int j=0; j<(int)nb.size(); j++) {
+	int n = nb[j].second;
+	vector<int> &links = adj[lofs[n]+l];
+
+	adj[lofs[i]+l].push_back(n);
+	links.push_back(i);
+	if( (int)links.size() <= Mmax )
+	  continue;
+
+	//Too many links: keep the most diverse ones
+	vector< pair<int,int> > cand;
+	for(int t=0; t<(int)links.size(); t++)
+	  cand.push_back(make_pair(dist(proto + (size_t)n*DP, proto + (size_t)links[t]*DP, DP),
+				   links[t]));
+	selectLinks(&cand, Mmax);
+
+	links.clear();
+	for(int t=0; t<(int)cand.size(); t++)
+	  links.push_back(cand[t].second);
+      }
+    }
+
+    if( level[i] > maxLevel ) {
+      maxLevel = level[i];
+      entry = i;
+    }
+  }
 }
 
-char *recNN::strClass(int c) {
-  return (char *)(key2cl[c]).c_str();
+//Keep up to M of the candidates (distance,prototype) to link with a
+//prototype: nearest first, skipping those that are closer to a prototype
+//already kept than to the base one, so that links go in all directions
+void recNN::selectLinks(vector< pair<int,int> > *cand, int M) {
+  vector< pair<int,int> > sel;
+
+  sort(cand->begin(), cand->end());
+  for(int i=0; i<(int)cand->size() && (int)sel.size() < M; i++) {
+    const unsigned char *e = proto + (size_t)(*cand)[i].second*DP;
+    bool keep=true;
+
+    for(int j=0; j<(int)sel.size() && keep; j++)
+      if( dist(e, proto + (size_t)sel[j].second*DP, DP) < (*cand)[i].first )
+	keep = false;
+
+    if( keep )
+      sel.push_back((*cand)[i]);
+  }
+
+  cand->swap(sel);
 }
 
-int recNN::keyClass(char *str) {
-  if( cl2key.find(str) == cl2key.end() ) {
-    fprintf(stderr, "Warning: Class '%s' doesn't appear in symbols database\n", str);
-    return -1;
+//Beam search in the level l of the graph from the entry points 'res'
+//(distance,prototype), that are replaced by the ef nearest prototypes
+//found in increasing order of distance. If nbest > 0, every prototype
+//computed is also inserted in the n-best list
+void recNN::searchLayer(const unsigned char *q, int ef, int l, vector<char> *seen,
+			vector< pair<int,int> > *res, unsigned long *w, int nbest,
+			int *k, float *p, int *id) {
+  //Prototypes to expand (nearest first) and the nearest found (farthest first)
+  priority_queue< pair<int,int>, vector< pair<int,int> >, greater< pair<int,int> > > cand;
+  priority_queue< pair<int,int> > best;
+  vector<int> visited;
+
+  for(int i=0; i<(int)res->size(); i++) {
+    (*seen)[(*res)[i].second] = 1;
+    visited.push_back((*res)[i].second);
+    cand.push((*res)[i]);
+    best.push((*res)[i]);
+    if( (int)best.size() > ef )
+      best.pop();
+  }
+
+  while( !cand.empty() && cand.top().first <= best.top().first ) {
+    int c = cand.top().second;
+    cand.pop();
+
+    vector<int> &links = adj[lofs[c]+l];
+    for(int j=0; j<(int)links.size(); j++) {
+      int n = links[j];
+      if( (*seen)[n] )
+	continue;
+      (*seen)[n] = 1;
+      visited.push_back(n);
+
+      //Distances beyond the beam and the n-best list are abandoned
+      int bound = (int)best.size() < ef ? INT_MAX : best.top().first;
+      if( nbest > 0 )
+	bound = max(bound, nbestBound(p));
+
+      int len, dis = distBound(q, proto + (size_t)n*DP, DP, bound, &len);
+      *w += len;
+      if( dis > bound )
+	continue;
+
+      if( nbest > 0 && dis <= nbestBound(p) )
+	insertNBest(nbest, k, p, id, label[n], dis, orig[n]);
+
+      if( (int)best.size() < ef || dis < best.top().first ) {
+	cand.push(make_pair(dis, n));
+	best.push(make_pair(dis, n));
+	if( (int)best.size() > ef )
+	  best.pop();
+      }
+    }
+  }
+
+  res->resize(best.size());
+  for(int i=best.size()-1; i>=0; i--) {
+    (*res)[i] = best.top();
+    best.pop();
   }
-  return cl2key[str];
+
+  for(int i=0; i<(int)visited.size(); i++)
+    (*seen)[visited[i]] = 0;
+}
+
+//Greedy descent from the entry point to the bottom level of the graph,
+//where the beam has at least nbest prototypes
+void recNN::searchGraph(const unsigned char *q, int nbest, int *k, float *p,
+			int *id, unsigned long *w) {
+  vector<char> seen(N, 0);
+
+  int d = dist(q, proto + (size_t)entry*DP, DP);
+  *w += DP;
+  insertNBest(nbest, k, p, id, label[entry], d, orig[entry]);
+
+  vector< pair<int,int> > ep(1, make_pair(d, entry));
+  for(int l=maxLevel; l>0; l--)
+    searchLayer(q, 1, l, &seen, &ep, w, nbest, k, p, id);
+  searchLayer(q, max(annEf, nbest), 0, &seen, &ep, w, nbest, k, p, id);
+}
+
+//Fraction of the distance computations of exhaustive search skipped by
+//the vectors searched one by one (the batches always compute all of
+//them), or -1 if none was
+float recNN::skipped() {
+  return total ? 1 - (double)work/total : -1;
 }
 
-int recNN::getNClasses() {
-  return C;
+//Fraction of the values of the prototypes with ink (not white). The
+//prototypes are searched sparse if it is at most SPARSE_DENSITY
+float recNN::inkDensity() {
+  return density;
 }
 
-int recNN::symType(int k) {
-  return type[k];
+bool recNN::isSparse() {
+  return sparse;
 }
@@ -25,31 +25,132 @@
 #include <vector>
 
 class ProduccionT;
+class ClassCache;
 
 #include "production.h"
+#include "symclass.h"
+#include "distance.h"
 
 using namespace std;
 
-class recNN{
-  int **data;
-  int *type;
-  map<string,int> cl2key;
-  vector<string> key2cl;
+//Node of the vantage-point tree. Inner nodes split the prototypes by
+//their distance to the vantage point 'vp': the subtree 'in' has the
+//distances in [inLo,inHi] and 'out' in [outLo,outHi]. Leaves (vp < 0)
+//hold the prototypes [first,first+n) of the matrix
+struct vpnode{
+  int vp;
+  int in, out;
+  double inLo, inHi, outLo, outHi;
+  int first, n;
+};
+
+struct ShardPool;
+
+class recNN : public SymClassifier{
+  //Prototypes in the order of the leaves of the tree, one row of DP
+  //values each with the dimensions sorted by decreasing variance. Every
+  //value is the ink of the pixel (its deviation from white, 255-pixel),
+  //so the background is 0 and distances are those of the pixels
+  unsigned char *proto;
+  int *label;   //Class of every prototype
+  int *orig;    //Position of every prototype in the database file
+  int *perm;    //Dimension of the sample stored in every column
+  int *cmember; //Prototypes grouped by class
+  int *cfirst;  //First prototype of every class in 'cmember'
+  unsigned char *cent; //Centroids of the classes
+  bool byCentroid;     //Visit the classes by distance to their centroid
+  vector<vpnode> tree; //Vantage-point tree of the prototypes
+  bool useTree;        //Search the tree instead of a linear scan
+
+  //Projection of the prototypes on the first pcaDims principal components,
+  //rows of pcaStride floats with the norm of the residual after them. It
+  //gives a lower bound of the distance to screen the prototypes
+  int pcaDims, pcaStride;
+  double *pcaBasis, *pcaMean;
+  float *pcaProj;
+  distFloatFunc distFloat;
 
-  int D; //Sample's dimensions
-  int C; //Number of classes
+  //Approximate search in a hierarchical graph of nearest neighbours
+  //(HNSW): node i has the levels [0,level[i]] and its links in a level l
+  //are adj[lofs[i]+l]. The search is exact if annEf <= 0
+  vector<int> level, lofs;
+  vector< vector<int> > adj;
+  int entry, maxLevel;
+  int annEf, annM, annEfc;
+  int *pnorm; //Squared norm of every prototype
+
+  //Sparse prototypes (if the ink is sparse enough, see SPARSE_DENSITY):
+  //the values of the prototype i that are not 0 are nzVal[nzFirst[i]..
+  //nzFirst[i+1]) in the columns nzCol (D < 256). Distances are
+  //|q|^2+|p|^2-2 q.p with the dot product on them only
+  bool sparse;
+  int *nzFirst;
+  unsigned char *nzCol, *nzVal;
+  float density; //Fraction of values that are not 0
+  int threads;     //Threads that search the shards of large databases
+  ShardPool *pool; //Threads waiting for shards (threads-1 of them)
+  distFunc dist;            //Distance kernels
+  distBoundFunc distBound;
+  dot4Func dot4;
+  unsigned long work, total; //Dimensions computed and of exhaustive search
+  ClassCache *cache;         //Results of the last vectors (if not NULL)
+  string cacheFile;
+  unsigned int tag;          //Hash of the database, stored with the cache
+  unsigned long hits, lookups;
+
+  int DP; //Length of the rows of the prototypes (D padded with zeros)
   int N; //Number of samples
+  void *mapped;  //Compiled database mapped, that holds the arrays
+  size_t mapSize;
+
+  void build(FILE *bd);
+  void loadCompiled(FILE *bd);
+  bool checkCompiled(int nodes, int nz);
+
+  int buildTree(const unsigned char *m, vector<int> &it, int lo, int hi,
+		vector<int> *order);
+  void searchTree(int node, const unsigned char *q, const float *qp, int qn, int nbest,
+		  int *k, float *p, int *id, unsigned long *w, volatile int *cap=NULL);
+  void searchLinear(const unsigned char *q, const float *qp, int qn, int nbest, int *k,
+		    float *p, int *id, unsigned long *w);
+  int protoDist(const unsigned char *q, int qn, int i, int bound, int *len);
+  void project(const unsigned char *v, float *a);
+  bool screened(const float *qp, int i, int bound);
+  void search(int *vec, int nbest, int *k, float *p);
+  void searchBatch(int *vecs, int M, int nbest, int *k, float *p);
+  void normalize(const int *vec, unsigned char *v);
+  bool cached();
+  void scanBatch(const unsigned char *q, const int *qnorm, int M, int nbest,
+		 int *k, float *p, int *id, int i0, int i1);
+  int shards();
+  void searchShards(const unsigned char *q, const float *qp, int qn, const int *qnorm,
+		    int M, int nbest, int *k, float *p, int *id, unsigned long *w);
+  static void *shardWorker(void *arg);
+  void buildGraph();
+  void searchLayer(const unsigned char *q, int ef, int l, vector<char> *seen,
+		   vector< pair<int,int> > *res, unsigned long *w, int nbest=0,
+		   int *k=NULL, float *p=NULL, int *id=NULL);
+  void selectLinks(vector< pair<int,int> > *cand, int M);
+  void searchGraph(const unsigned char *q, int nbest, int *k, float *p,
+		   int *id, unsigned long *w);
 
  public:
   recNN(FILE *bd, FILE *tp);
   ~recNN();
 
   void print();
+  bool save(FILE *fd);
   void classify(int *vec, int nbest, int *k, float *p);
-  char *strClass(int c);
-  int keyClass(char *str);
-  int getNClasses();
-  int symType(int k);
+  void classifyBatch(int *vecs, int M, int nbest, int *k, float *p);
+  void setANN(int ef, int M=16, int efc=100);
+  void setPCA(int dims);
+  void setThreads(int n);
+  void setCache(int size, const char *file=NULL);
+  void saveCache();
+  void cacheStats(unsigned long *hits, unsigned long *lookups);
+  float skipped();
+  float inkDensity();
+  bool isSparse();
 };
 
 
@@ -19,96 +19,769 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cmath>
-#include <map>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <list>
+#include <pthread.h>
 #include <Magick++.h>
 #include "sample.h"
 #include "mfset.h"
+#include "pnm.h"
+#include "binarize.h"
 
 using namespace std;
 using namespace Magick;
 
-Sample::Sample(char *str) {
-  img = new Image(str);
-  X=img->columns();
-  Y=img->rows();
-  
-  data = new unsigned char*[Y];
-  for(int y=0; y<Y; y++) {
-    data[y] = new unsigned char[X];
-    for( int x=0; x<X; x++) {
-      Color pc = img->pixelColor(x,y);
-      data[y][x] = 255*((float)pc.redQuantum()/MaxRGB);
+//Minimum number of rows of the stripes labeled concurrently and of
+//runs of the chunks whose bounding boxes are reduced concurrently
+#define MIN_STRIPE 64
+#define MIN_CHUNK  4096
+
+int Sample::threads = 1;
+
+//Gray levels (red channel) of a decoded image in a new pixel buffer
+static unsigned char *imagePixels(Image &img, int *stride) {
+  int X=img.columns();
+  int Y=img.rows();
+
+  //Bulk export from the pixel cache
+  unsigned char *pix = newPixels(X, Y, stride);
+  img.write(0, 0, X, Y, "R", CharPixel, pix);
+
+  //Move the rows to their aligned position (last row first)
+  for(int y=Y-1; y>0; y--)
+    memmove(pix + (size_t)y*(*stride), pix + (size_t)y*X, X);
+
+  return pix;
+}
+
+Sample::Sample(char *str, int refHeight, int bin) {
+  page = 0;
+
+  //Pre-segmented connected components
+  if( loadComponents(str) ) {
+    scale = 1;
+    X0 = X;
+    Y0 = Y;
+    return;
+  }
+
+  //Binary PGM/PBM files are read directly, other formats through Magick++
+  int stride;
+  unsigned char *pix = loadPNM(str, &X, &Y, &stride);
+
+  if( !pix ) {
+    //The decoded image is only needed to fill 'pix'
+    Image img(str);
+    X=img.columns();
+    Y=img.rows();
+    pix = imagePixels(img, &stride);
+  }
+
+  X0 = X;
+  Y0 = Y;
+  setPixels(pix, stride, 8, refHeight, bin);
+
+  //Only the ink of the components is kept
+  freePixels(pix);
+}
+
+//Sample over the pixels of a buffer of 8-bit gray levels (depth=8) or
+//of 1-bit pixels with the most significant bit first and 1 as ink
+//(depth=1). The buffer is not copied, only the gray levels of the ink.
+//If refHeight > 0 the resolution is normalized (see setPixels) and gray
+//images are binarized with the method 'bin' (see binarize.h)
+Sample::Sample(const unsigned char *buf, int w, int h, int rowBytes, int depth,
+	       int refHeight, int bin) {
+  if( depth != 8 && depth != 1 ) {
+    fprintf(stderr, "Sample: Unsupported pixel depth %d\n", depth);
+    exit(-1);
+  }
+
+  X0 = X = w;
+  Y0 = Y = h;
+  page = 0;
+  setPixels(buf, rowBytes, depth, refHeight, bin);
+}
+
+//Sample from pre-segmented connected components, no labeling is done
+Sample::Sample(const glyph *gl, int n) {
+  X = Y = 0;
+  page = 0;
+  scale = 1;
+  setGlyphs(gl, n);
+  X0 = X;
+  Y0 = Y;
+}
+
+//Sample with the connected components 'cc' of another sample
+Sample::Sample(Sample *m, const vector<int> &cc) {
+  vector<run> runs;
+  vector<unsigned char> gray;
+  vector<int> label;
+
+  X = m->X;
+  Y = m->Y;
+  X0 = m->X0;
+  Y0 = m->Y0;
+  scale = m->scale;
+  page = m->page;
+
+  for(int i=0; i<(int)cc.size(); i++) {
+    component *c = &m->comps[cc[i]];
+    for(int r=c->r0; r<c->r0+c->nr; r++) {
+      run rn = m->cruns[r];
+      rn.g = gray.size();
+      gray.insert(gray.end(), m->ink + m->cruns[r].g,
+		  m->ink + m->cruns[r].g + rn.s-rn.x+1);
+      runs.push_back(rn);
+      label.push_back(i);
     }
   }
 
-  mfset = new MFSET(X, Y);
-  int fondo=0;
-  int conex[8][2] = {{-1,-1},{0,-1},{1,-1},
-		     {-1, 0},	    {1, 0},
-		     {-1,+1},{0,+1},{1,+1}};
-  
-  for(int y=0; y<Y; y++)
-    for(int x=0; x<X; x++) {
-      if( get(x,y)<255 ) { //If it is foreground pixel
-	for(int cx=0; cx<8; cx++) {
-	  int px = x+conex[cx][0];
-	  int py = y+conex[cx][1];
-
-	  if( ( px < 0 || px >= X ) 
-	      || ( py < 0 || py >= Y ) )
-	    continue;
+  setComponents(runs, label, gray);
+}
 
-	  if( get(px,py)<255 )
-	    mfset->merge(x,y, px,py);
-	}
-      }
+//Load every page (frame) of a file as a sample
+void Sample::loadPages(char *path, vector<Sample *> *pages, int refHeight,
+		       int bin) {
+  FILE *fd = fopen(path, "rb");
+  if( !fd ) {
+    fprintf(stderr, "Error loading file '%s'\n", path);
+    exit(-1);
+  }
+
+  char magic[2];
+  bool single = fread(magic, 1, 2, fd) == 2
+    && ((magic[0]=='P' && (magic[1]=='4' || magic[1]=='5'))
+	|| (magic[0]=='C' && magic[1]=='C'));
+  fclose(fd);
+
+  //PNM and components files have a single page
+  if( single ) {
+    pages->push_back( new Sample(path, refHeight, bin) );
+    return;
+  }
+
+  list<Image> frames;
+  readImages(&frames, path);
+
+  for(list<Image>::iterator it=frames.begin(); it!=frames.end(); it++) {
+    int stride;
+    unsigned char *pix = imagePixels(*it, &stride);
+    Sample *m = new Sample(pix, it->columns(), it->rows(), stride, 8, refHeight, bin);
+
+    m->page = pages->size();
+    pages->push_back( m );
+    freePixels(pix);
+  }
+}
+
+//Append the runs of foreground pixels of a row of w pixels, whose first
+//pixel is (x0,y), and store their gray levels in 'ink'. The gray levels
+//of a 1-bit row are taken from 'gray' if given (foreground mask)
+static void rowRuns(const unsigned char *row, int w, int bpp, int x0, int y,
+		    vector<run> *runs, vector<unsigned char> *ink,
+		    const unsigned char *gray=NULL) {
+  int (*next)(const unsigned char *, int, int, bool) = bpp==1 ? nextBit : nextPixel;
+
+  for(int x=next(row, 0, w, true); x<w; x=next(row, x, w, true)) {
+    run r;
+    r.y = y;
+    r.x = x0 + x;
+    r.g = ink->size();
+
+    int e = next(row, x, w, false);
+    if( gray )
+      ink->insert(ink->end(), gray+x, gray+e);
+    else if( bpp == 1 ) //Binary ink is black
+      ink->insert(ink->end(), e-x, 0);
+    else
+      ink->insert(ink->end(), row+x, row+e);
+
+    r.s = x0 + e-1;
+    x = e;
+    runs->push_back(r);
+  }
+}
+
+//Gray level of pixel x of a row of 8-bit or 1-bit pixels
+static inline int pixel(const unsigned char *row, int x, int bpp) {
+  if( bpp == 1 )
+    return (row[x>>3] >> (7 - (x&7))) & 1 ? 0 : 255;
+
+  return row[x];
+}
+
+//Reduce an image by an integer factor k. Every pixel of the result is the
+//mean of a block of k x k pixels, hence it is ink if any of them is ink
+static unsigned char *reduce(const unsigned char *pix, int X, int Y, int stride,
+			     int bpp, int k, int *nx, int *ny, int *nstride) {
+  *nx = (X+k-1)/k;
+  *ny = (Y+k-1)/k;
+  unsigned char *red = newPixels(*nx, *ny, nstride);
+  int *sum = new int[*nx];
+
+  for(int ry=0; ry<*ny; ry++) {
+    int y0 = ry*k, y1 = min(y0+k, Y);
+
+    for(int rx=0; rx<*nx; rx++)
+      sum[rx] = 0;
+
+    for(int y=y0; y<y1; y++) {
+      const unsigned char *row = pix + (size_t)y*stride;
+      for(int x=0; x<X; x++)
+	sum[x/k] += pixel(row, x, bpp);
+    }
+
+    for(int rx=0; rx<*nx; rx++) {
+      int n = (min(rx*k+k, X) - rx*k) * (y1-y0);
+      red[(size_t)ry*(*nstride) + rx] = sum[rx]/n;
+    }
+  }
+
+  delete[] sum;
+
+  return red;
+}
+
+//Label the components of the image. If refHeight > 0 the height of the
+//symbols is estimated as the median height of those components, and if
+//it is at least twice refHeight the image is reduced by the largest
+//power of two that keeps them at least refHeight pixels tall, and
+//labeled again. The components are found at full resolution because in
+//a coarse image neighbouring symbols (or the parts of a fraction) merge
+//and look taller than they are. Other factors split the pixels of
+//resolutions multiple of 2 (150, 300, 600 dpi) unevenly, which changes
+//the shape of thin strokes. Coordinates are mapped back by toImage
+void Sample::setPixels(const unsigned char *pix, int stride, int bpp, int refHeight,
+		       int bin) {
+  scale = 1;
+  binarizeComponents(pix, stride, bpp, bin);
+
+  if( refHeight <= 0 )
+    return;
+
+  int h = medianHeight(), k=1;
+  while( 2*k*refHeight <= h )
+    k *= 2;
+  if( k < 2 )
+    return;
+
+  int rstride;
+  unsigned char *red = reduce(pix, X, Y, stride, bpp, k, &X, &Y, &rstride);
+  scale = k;
+  freeComponents();
+  binarizeComponents(red, rstride, 8, bin);
+  freePixels(red);
+}
+
+//Label the components of the foreground mask of the image given by the
+//binarization method 'bin' (binary images are not binarized again)
+void Sample::binarizeComponents(const unsigned char *pix, int stride, int bpp,
+				int bin) {
+  if( bin == BIN_NONE || bpp == 1 ) {
+    labelComponents(pix, stride, bpp);
+    return;
+  }
+
+  int mstride;
+  unsigned char *mask = binarize(pix, X, Y, stride, bin, &mstride);
+  labelComponents(mask, mstride, 1, pix, stride);
+  freePixels(mask);
+}
+
+//Merge the runs [b0,b1) of a row with the 8-connected runs [a0,a1) of
+//the previous row. If 'label' is given, runs are merged by their labels
+static void mergeRows(MFSET *mfset, const vector<run> &runs, const int *label,
+		      int a0, int a1, int b0, int b1) {
+  int p=a0;
+  for(int r=b0; r<b1; r++) {
+    while( p<a1 && runs[p].s < runs[r].x-1 )
+      p++;
+    for(int q=p; q<a1 && runs[q].x <= runs[r].s+1; q++)
+      if( label )
+	mfset->merge(label[q], label[r]);
       else
-	fondo++;
+	mfset->merge(q, r);
+  }
+}
+
+//Stripe of rows [y0,y1) of an image labeled by a thread
+struct LabelStripe{
+  const unsigned char *pix, *gpix;
+  int stride, gstride, bpp, X, y0, y1;
+  vector<run> runs;
+  vector<unsigned char> gray;
+  vector<int> rowRun; //First run of every row of the stripe
+  vector<int> label;  //Set of every run within the stripe
+};
+
+static void *labelWorker(void *arg) {
+  LabelStripe *st = (LabelStripe *)arg;
+  int n = st->y1 - st->y0;
+
+  //Run-length encoding of the foreground pixels (row-major order)
+  st->rowRun.resize(n+1);
+  for(int y=st->y0; y<st->y1; y++) {
+    st->rowRun[y-st->y0] = st->runs.size();
+    rowRuns(st->pix + (size_t)y*st->stride, st->X, st->bpp, 0, y, &st->runs, &st->gray,
+	    st->gpix ? st->gpix + (size_t)y*st->gstride : NULL);
+  }
+  st->rowRun[n] = st->runs.size();
+
+  //Merge the runs of consecutive rows that are 8-connected
+  MFSET *mfset = new MFSET(st->runs.size());
+  for(int y=1; y<n; y++)
+    mergeRows(mfset, st->runs, NULL, st->rowRun[y-1], st->rowRun[y],
+	      st->rowRun[y], st->rowRun[y+1]);
+
+  st->label.resize(st->runs.size());
+  for(int i=0; i<(int)st->runs.size(); i++)
+    st->label[i] = mfset->find(i);
+
+  delete mfset;
+
+  return NULL;
+}
+
+//Label the connected components of the foreground pixels. If the gray
+//levels are given, 'pix' is the 1-bit foreground mask of that image.
+//Large images are split into horizontal stripes labeled concurrently
+//and the components crossing the stripe boundaries are merged after
+void Sample::labelComponents(const unsigned char *pix, int stride, int bpp,
+			     const unsigned char *gpix, int gstride) {
+  int S = max(1, min(threads, Y/MIN_STRIPE));
+  LabelStripe *st = new LabelStripe[S];
+
+  for(int s=0; s<S; s++) {
+    st[s].pix = pix;
+    st[s].gpix = gpix;
+    st[s].stride = stride;
+    st[s].gstride = gstride;
+    st[s].bpp = bpp;
+    st[s].X = X;
+    st[s].y0 = Y*s/S;
+    st[s].y1 = Y*(s+1)/S;
+  }
+
+  if( S == 1 )
+    labelWorker(st);
+  else {
+    pthread_t *th = new pthread_t[S];
+    for(int s=0; s<S; s++)
+      pthread_create(&th[s], NULL, labelWorker, &st[s]);
+    for(int s=0; s<S; s++)
+      pthread_join(th[s], NULL);
+    delete[] th;
+  }
+
+  vector<run> runs;
+  vector<unsigned char> gray;
+  vector<int> label;
+
+  if( S == 1 ) {
+    runs.swap(st[0].runs);
+    gray.swap(st[0].gray);
+    label.swap(st[0].label);
+  }
+  else {
+    //Join the stripes, with the labels as indexes of the joined runs
+    vector<int> first(S+1);
+    for(int s=0; s<S; s++) {
+      first[s] = runs.size();
+      int g0 = gray.size();
+      for(int i=0; i<(int)st[s].runs.size(); i++) {
+	runs.push_back(st[s].runs[i]);
+	runs.back().g += g0;
+	label.push_back(first[s] + st[s].label[i]);
+      }
+      gray.insert(gray.end(), st[s].gray.begin(), st[s].gray.end());
+    }
+    first[S] = runs.size();
+
+    //Merge the sets of the last row of a stripe and the first row of the next
+    MFSET *mfset = new MFSET(runs.size());
+    for(int s=1; s<S; s++) {
+      int n = st[s-1].y1 - st[s-1].y0;
+      mergeRows(mfset, runs, &label[0], first[s-1] + st[s-1].rowRun[n-1], first[s],
+		first[s], first[s] + st[s].rowRun[1]);
+    }
+
+    for(int i=0; i<(int)runs.size(); i++)
+      label[i] = mfset->find(label[i]);
+
+    delete mfset;
+  }
+
+  delete[] st;
+
+  setComponents(runs, label, gray);
+}
+
+//Every glyph is a component given by its bounding box and its bitmap
+void Sample::setGlyphs(const glyph *gl, int n) {
+  vector<run> runs;
+  vector<unsigned char> gray;
+  vector<int> label;
+
+  for(int i=0; i<n; i++) {
+    int w = gl[i].s - gl[i].x + 1;
+    int h = gl[i].t - gl[i].y + 1;
+    int rowBytes = gl[i].bpp==1 ? (w+7)/8 : w;
+
+    if( w <= 0 || h <= 0 || gl[i].x < 0 || gl[i].y < 0
+	|| (gl[i].bpp != 8 && gl[i].bpp != 1) ) {
+      fprintf(stderr, "Sample: Invalid component %d\n", i);
+      exit(-1);
+    }
+
+    for(int y=0; y<h; y++)
+      rowRuns(gl[i].pix + (size_t)y*rowBytes, w, gl[i].bpp,
+	      gl[i].x, gl[i].y + y, &runs, &gray);
+
+    label.resize(runs.size(), i);
+
+    X = max(X, gl[i].s+1);
+    Y = max(Y, gl[i].t+1);
+  }
+
+  setComponents(runs, label, gray);
+}
+
+//Bounding boxes and first pixels of the components of the runs [r0,r1)
+struct BoxChunk{
+  const run *runs;
+  const int *label, *rComp;
+  int *rcomp;
+  int r0, r1, NC;
+  component *box;
+  pair<int,int> *key;
+};
+
+static void *boxWorker(void *arg) {
+  BoxChunk *b = (BoxChunk *)arg;
+
+  for(int i=0; i<b->NC; i++)
+    b->box[i].rp = -1;
+
+  for(int i=b->r0; i<b->r1; i++) {
+    const run *r = &b->runs[i];
+    int n = b->rComp[b->label[i]];
+    component *c = &b->box[n];
+    pair<int,int> key(r->x, r->y);
+
+    if( c->rp < 0 ) {
+      c->x = r->x;
+      c->y = r->y;
+      c->s = r->s;
+      c->t = r->y;
+      c->rp = i;
+      c->n = c->sy = c->syy = 0;
+      b->key[n] = key;
     }
+    else {
+      if( r->x < c->x )
+	c->x = r->x;
+      if( r->y < c->y )
+	c->y = r->y;
+      if( r->s > c->s )
+	c->s = r->s;
+      if( r->y > c->t )
+	c->t = r->y;
+      if( key < b->key[n] )
+	b->key[n] = key;
+    }
+
+    double len = r->s - r->x + 1;
+    c->n += len;
+    c->sy += len*r->y;
+    c->syy += len*r->y*r->y;
+    b->rcomp[i] = n;
+  }
+
+  return NULL;
+}
+
+//Set the connected components from the foreground runs, the gray levels
+//of their pixels and the label of the component of every run (labels
+//are in [0,runs.size()) but not necessarily consecutive)
+void Sample::setComponents(vector<run> &runs, vector<int> &label,
+			   vector<unsigned char> &gray) {
+  NR = runs.size();
+
+  //Number of connected components
+  int *rComp = new int[NR];
+  for(int i=0; i<NR; i++)
+    rComp[i] = -1;
+
+  NC=0;
+  for(int i=0; i<NR; i++)
+    if( rComp[label[i]] < 0 )
+      rComp[label[i]] = NC++;
 
-  //Number of connected components found in the image
-  NC = mfset->get_nSets() - fondo;
   comps = new component[NC];
-  map<int,int> rComp;
-  int ncomp=0;
-
-  //Index components and compute bounding boxes
-  for(int x=0; x<X; x++)
-    for(int y=0; y<Y; y++)
-      if( get(x,y)<255 ) {
-	int rp = mfset->find(x,y);
-	if( rComp.find(rp) == rComp.end() ) {
-	  comps[ncomp].x = x;
-	  comps[ncomp].y = y;
-	  comps[ncomp].s = x;
-	  comps[ncomp].t = y;
-	  comps[ncomp].rp = rp;
-	  rComp[rp] = ncomp++;
-	}
-	else {
-	  int n = rComp[rp];
-	  if( x < comps[n].x )
-	    comps[n].x = x;
-	  if( y < comps[n].y )
-	    comps[n].y = y;
-	  if( x > comps[n].s )
-	    comps[n].s = x;
-	  if( y > comps[n].t )
-	    comps[n].t = y;
-	}
+  rcomp = new int[NR];
+
+  //Index components and compute bounding boxes, on chunks of runs
+  //reduced in parallel for large images
+  int S = max(1, min(threads, NR/MIN_CHUNK));
+  BoxChunk *bc = new BoxChunk[S];
+  for(int s=0; s<S; s++) {
+    bc[s].runs = NR ? &runs[0] : NULL;
+    bc[s].label = NR ? &label[0] : NULL;
+    bc[s].rComp = rComp;
+    bc[s].rcomp = rcomp;
+    bc[s].r0 = (int)((double)NR*s/S);
+    bc[s].r1 = (int)((double)NR*(s+1)/S);
+    bc[s].NC = NC;
+    bc[s].box = new component[NC];
+    bc[s].key = new pair<int,int>[NC];
+  }
+
+  if( S == 1 )
+    boxWorker(bc);
+  else {
+    pthread_t *th = new pthread_t[S];
+    for(int s=0; s<S; s++)
+      pthread_create(&th[s], NULL, boxWorker, &bc[s]);
+    for(int s=0; s<S; s++)
+      pthread_join(th[s], NULL);
+    delete[] th;
+  }
+
+  //Components are numbered in column-major order of their first pixel
+  //(leftmost column, then topmost row)
+  vector< pair<pair<int,int>,int> > ord(NC);
+  for(int i=0; i<NC; i++) {
+    comps[i].rp = -1;
+    ord[i] = make_pair(make_pair(X,Y), i);
+  }
+
+  //Join the chunks in order, so the first run of every component is kept
+  for(int s=0; s<S; s++) {
+    for(int n=0; n<NC; n++) {
+      component *c = &bc[s].box[n];
+      if( c->rp < 0 )
+	continue;
+
+      if( comps[n].rp < 0 )
+	comps[n] = *c;
+      else {
+	comps[n].x = min(comps[n].x, c->x);
+	comps[n].y = min(comps[n].y, c->y);
+	comps[n].s = max(comps[n].s, c->s);
+	comps[n].t = max(comps[n].t, c->t);
+	comps[n].n += c->n;
+	comps[n].sy += c->sy;
+	comps[n].syy += c->syy;
       }
+      if( bc[s].key[n] < ord[n].first )
+	ord[n].first = bc[s].key[n];
+    }
+
+    delete[] bc[s].box;
+    delete[] bc[s].key;
+  }
+  delete[] bc;
+
+  sort(ord.begin(), ord.end());
+
+  component *sorted = new component[NC];
+  int *pos = new int[NC];
+  for(int i=0; i<NC; i++) {
+    sorted[i] = comps[ord[i].second];
+    pos[ord[i].second] = i;
+  }
+  for(int i=0; i<NR; i++)
+    rcomp[i] = pos[rcomp[i]];
+
+  delete[] comps;
+  comps = sorted;
+
+  //Runs of every component (row-major order)
+  cruns = new run[NR];
+  for(int i=0; i<NC; i++)
+    comps[i].nr = 0;
+  for(int i=0; i<NR; i++)
+    comps[rcomp[i]].nr++;
+  for(int i=0, r0=0; i<NC; i++) {
+    comps[i].r0 = r0;
+    r0 += comps[i].nr;
+    comps[i].nr = 0;
+  }
+  for(int i=0; i<NR; i++) {
+    component *c = &comps[rcomp[i]];
+    cruns[c->r0 + c->nr++] = runs[i];
+  }
+
+  //Gray levels of the ink
+  ink = new unsigned char[gray.size()];
+  if( !gray.empty() )
+    memcpy(ink, &gray[0], gray.size());
+
+  delete[] pos;
+  delete[] rComp;
 
+  buildGrid();
+}
+
+//Load a file of pre-segmented connected components. It returns false
+//if the file is not in this format. The format is a header line "CC1",
+//a line with the image size and the number of components "X Y N" and,
+//for every component, a line "x y s t bpp" followed by its bitmap rows
+bool Sample::loadComponents(char *path) {
+  FILE *fd = fopen(path, "rb");
+  if( !fd )
+    return false;
+
+  char magic[4];
+  if( fread(magic, 1, 4, fd) != 4 || strncmp(magic, "CC1", 3)
+      || (magic[3] != '\n' && magic[3] != ' ') ) {
+    fclose(fd);
+    return false;
+  }
+
+  int n;
+  if( fscanf(fd, "%d %d %d", &X, &Y, &n) != 3 || n < 0 ) {
+    fprintf(stderr, "Error: Invalid components file '%s'\n", path);
+    exit(-1);
+  }
+
+  glyph *gl = new glyph[n];
+  for(int i=0; i<n; i++) {
+    if( fscanf(fd, "%d %d %d %d %d", &gl[i].x, &gl[i].y, &gl[i].s, &gl[i].t,
+	       &gl[i].bpp) != 5 || getc(fd) != '\n' || gl[i].s < gl[i].x || gl[i].t < gl[i].y ) {
+      fprintf(stderr, "Error: Invalid component %d in '%s'\n", i, path);
+      exit(-1);
+    }
+
+    int w = gl[i].s - gl[i].x + 1;
+    size_t len = (size_t)(gl[i].bpp==1 ? (w+7)/8 : w) * (gl[i].t - gl[i].y + 1);
+    unsigned char *bmp = new unsigned char[len];
+    if( fread(bmp, 1, len, fd) != len ) {
+      fprintf(stderr, "Error: Truncated components file '%s'\n", path);
+      exit(-1);
+    }
+    gl[i].pix = bmp;
+  }
+  fclose(fd);
+
+  setGlyphs(gl, n);
+
+  for(int i=0; i<n; i++)
+    delete[] gl[i].pix;
+  delete[] gl;
+
+  return true;
+}
+
+//Save the connected components with 8-bit bitmaps (see loadComponents)
+void Sample::saveComponents(char *path) {
+  FILE *fd = fopen(path, "wb");
+  if( !fd ) {
+    fprintf(stderr, "Error saving components file '%s'\n", path);
+    exit(-1);
+  }
+
+  fprintf(fd, "CC1\n%d %d %d\n", X, Y, NC);
+  for(int i=0; i<NC; i++) {
+    int w = comps[i].s - comps[i].x + 1;
+    int h = comps[i].t - comps[i].y + 1;
+    unsigned char *bmp = new unsigned char[w*h];
+
+    memset(bmp, 255, w*h);
+    for(int r=comps[i].r0; r<comps[i].r0+comps[i].nr; r++)
+      memcpy(&bmp[(cruns[r].y-comps[i].y)*w + cruns[r].x-comps[i].x],
+	     &ink[cruns[r].g], cruns[r].s-cruns[r].x+1);
+
+    fprintf(fd, "%d %d %d %d 8\n", comps[i].x, comps[i].y, comps[i].s, comps[i].t);
+    fwrite(bmp, 1, w*h, fd);
+    delete[] bmp;
+  }
+
+  fclose(fd);
+}
+
+//Uniform grid index of the component bounding boxes. The cell size is
+//the median size of the components, so that a query around a symbol
+//only visits a few cells
+void Sample::buildGrid() {
+  vector<int> sz(NC);
+  for(int i=0; i<NC; i++)
+    sz[i] = max(comps[i].s-comps[i].x, comps[i].t-comps[i].y) + 1;
+
+  G = 1;
+  if( NC > 0 ) {
+    nth_element(sz.begin(), sz.begin()+NC/2, sz.end());
+    G = max(sz[NC/2], 1);
+  }
+  GX = X/G + 1;
+  GY = Y/G + 1;
+
+  //Count the entries of every cell and store them as consecutive lists
+  gcell = new int[GX*GY+1];
+  for(int i=0; i<=GX*GY; i++)
+    gcell[i] = 0;
+
+  for(int i=0; i<NC; i++)
+    for(int gy=comps[i].y/G; gy<=comps[i].t/G; gy++)
+      for(int gx=comps[i].x/G; gx<=comps[i].s/G; gx++)
+	gcell[gy*GX + gx + 1]++;
+
+  for(int i=0; i<GX*GY; i++)
+    gcell[i+1] += gcell[i];
+
+  gcomp = new int[gcell[GX*GY]];
+  vector<int> pos(gcell, gcell+GX*GY);
+  for(int i=0; i<NC; i++)
+    for(int gy=comps[i].y/G; gy<=comps[i].t/G; gy++)
+      for(int gx=comps[i].x/G; gx<=comps[i].s/G; gx++)
+	gcomp[ pos[gy*GX + gx]++ ] = i;
+
+  mark = new int[NC];
+  for(int i=0; i<NC; i++)
+    mark[i] = 0;
+  stamp = 0;
+}
+
+//Number of threads used to label the connected components
+void Sample::setThreads(int n) {
+  threads = max(n, 1);
 }
 
 Sample::~Sample() {
-  for(int y=0; y<Y; y++)
-    delete[] data[y];
-  delete[] data;
-  delete mfset;
+  freeComponents();
+}
+
+void Sample::freeComponents() {
+  delete[] comps;
+  delete[] cruns;
+  delete[] rcomp;
+  delete[] ink;
+  delete[] gcell;
+  delete[] gcomp;
+  delete[] mark;
 }
 
+//Gray level of pixel (x,y)
 unsigned char Sample::get(int x, int y) {
-  return data[y][x];
+  if( x < 0 || y < 0 || x >= X || y >= Y )
+    return 255;
+
+  int cell = (y/G)*GX + x/G;
+  for(int i=gcell[cell]; i<gcell[cell+1]; i++) {
+    component *c = &comps[gcomp[i]];
+    if( x < c->x || x > c->s || y < c->y || y > c->t )
+      continue;
+
+    for(int r=c->r0; r<c->r0+c->nr; r++)
+      if( cruns[r].y == y && cruns[r].x <= x && x <= cruns[r].s )
+	return ink[cruns[r].g + x-cruns[r].x];
+  }
+
+  return 255;
 }
 
 int Sample::dimX() {
@@ -123,39 +796,253 @@ int Sample::nComponents() {
   return NC;
 }
 
-int Sample::rp2cmp(int rp) {
+int Sample::getPage() {
+  return page;
+}
+
+//Bounding box of all the components
+void Sample::bbox(int *x, int *y, int *s, int *t) {
+  if( NC == 0 ) {
+    *x = *y = *s = *t = -1;
+    return;
+  }
+
+  *x = comps[0].x;
+  *y = comps[0].y;
+  *s = comps[0].s;
+  *t = comps[0].t;
+  for(int i=1; i<NC; i++) {
+    *x = min(*x, comps[i].x);
+    *y = min(*y, comps[i].y);
+    *s = max(*s, comps[i].s);
+    *t = max(*t, comps[i].t);
+  }
+}
+
+//Map a region of the sample to the coordinates of the original image
+void Sample::toImage(int *x, int *y, int *s, int *t) {
+  if( scale == 1 || *x < 0 )
+    return;
+
+  *x *= scale;
+  *y *= scale;
+  *s = min(*s*scale + scale-1, X0-1);
+  *t = min(*t*scale + scale-1, Y0-1);
+}
+
+//Median height of the connected components
+int Sample::medianHeight() {
+  if( NC == 0 )
+    return 0;
+
+  vector<int> hs(NC);
   for(int i=0; i<NC; i++)
-    if( comps[i].rp == rp )
-      return i;
+    hs[i] = comps[i].t - comps[i].y + 1;
+  nth_element(hs.begin(), hs.begin()+NC/2, hs.end());
 
-  return -1;
+  return hs[NC/2];
 }
 
-void Sample::getRegion(int *vec, int nComp, int *as, int *cn, int *ds) {
-  getRegion(vec, comps[nComp].x, comps[nComp].y,
-	         comps[nComp].s, comps[nComp].t, comps[nComp].rp);
-
- 
-  int n=0, cen=0;
-  float asc=0, des=0;
-  float wasc=0.1, wdes=1.9;
-  float paso=1.8/(comps[nComp].t-comps[nComp].y);
-
-  for(int y=comps[nComp].y; y<=comps[nComp].t; y++) {
-    for(int x=comps[nComp].x; x<=comps[nComp].s; x++)
-      if( get(x,y)<255 && mfset->find(x,y)==comps[nComp].rp ) {
-	n++;
-	asc += y*wasc;
-	cen += y;
-	des += y*wdes;
+//Group the connected components into expression regions. Regions are
+//separated by rows of whitespace of at least 'lineGap' times the median
+//component height and, within those bands, by columns of whitespace of
+//at least 'wordGap' times that height
+void Sample::segment(vector< vector<int> > *regions, float lineGap, float wordGap) {
+  regions->clear();
+  if( NC == 0 )
+    return;
+
+  float h = medianHeight();
+
+  //Horizontal bands
+  vector< pair<int,int> > ord(NC);
+  for(int i=0; i<NC; i++)
+    ord[i] = make_pair(comps[i].y, i);
+  sort(ord.begin(), ord.end());
+
+  for(int i=0; i<NC; ) {
+    vector< pair<int,int> > band;
+    int bt = comps[ord[i].second].t;
+
+    while( i<NC && comps[ord[i].second].y - bt - 1 < lineGap*h ) {
+      bt = max(bt, comps[ord[i].second].t);
+      band.push_back( make_pair(comps[ord[i].second].x, ord[i].second) );
+      i++;
+    }
+
+    //Regions of the band
+    sort(band.begin(), band.end());
+    for(int j=0; j<(int)band.size(); ) {
+      vector<int> reg;
+      int bs = comps[band[j].second].s;
+
+      while( j<(int)band.size() && comps[band[j].second].x - bs - 1 < wordGap*h ) {
+	bs = max(bs, comps[band[j].second].s);
+	reg.push_back(band[j].second);
+	j++;
       }
-    wasc+=paso;
-    wdes-=paso;
+      regions->push_back(reg);
+    }
+  }
+}
+
+//Remove the specks (scanner dust, compression noise) before parsing.
+//With the ink-weighted median component height h as reference symbol
+//size and the median run length w as pen width, a component smaller
+//than maxSize*h is a speck if it has less than minArea*w*w pixels (dots
+//of the symbols are about w*w) or its mean darkness is below minInk (in
+//[0,1]). Specks within absorbDist*h of another component are absorbed
+//by it (broken pieces of a symbol) and the rest are dropped. It returns
+//the number of components removed
+int Sample::despeckle(float minArea, float minInk, float maxSize,
+		      float absorbDist, bool verbose) {
+  if( NC == 0 )
+    return 0;
+
+  //Pixels and darkness of every component
+  vector<int> area(NC, 0);
+  vector<float> dark(NC, 0);
+  for(int i=0; i<NC; i++) {
+    int sum=0;
+    for(int r=comps[i].r0; r<comps[i].r0+comps[i].nr; r++) {
+      area[i] += cruns[r].s - cruns[r].x + 1;
+      for(int k=0; k<=cruns[r].s-cruns[r].x; k++)
+	sum += 255 - ink[cruns[r].g + k];
+    }
+    dark[i] = sum / (255.0*area[i]);
+  }
+
+  //Reference height: weighting by the pixels, a lot of specks do not
+  //bias the estimate towards their size
+  vector< pair<int,int> > hs(NC);
+  long total=0;
+  for(int i=0; i<NC; i++) {
+    hs[i] = make_pair(comps[i].t - comps[i].y + 1, area[i]);
+    total += area[i];
+  }
+  sort(hs.begin(), hs.end());
+  float h=0;
+  for(int i=0, acc=0; i<NC; i++) {
+    acc += hs[i].second;
+    if( 2*acc >= total ) {
+      h = hs[i].first;
+      break;
+    }
+  }
+
+  //Pen width: median length of the runs of the components at least
+  //half as tall as the reference
+  vector<int> len;
+  for(int i=0; i<NC; i++)
+    if( 2*(comps[i].t - comps[i].y + 1) >= h )
+      for(int r=comps[i].r0; r<comps[i].r0+comps[i].nr; r++)
+	len.push_back(cruns[r].s - cruns[r].x + 1);
+  nth_element(len.begin(), len.begin()+len.size()/2, len.end());
+  float pw = len[len.size()/2];
+
+  vector<bool> speck(NC, false);
+  int nspecks=0;
+  for(int i=0; i<NC; i++) {
+    int sz = max(comps[i].s-comps[i].x, comps[i].t-comps[i].y) + 1;
+    if( sz < maxSize*h && (area[i] < minArea*pw*pw || dark[i] < minInk) ) {
+      speck[i] = true;
+      nspecks++;
+    }
   }
 
-  *as = asc/n;
-  *cn = cen/n;
-  *ds = des/n;
+  if( nspecks == 0 )
+    return 0;
+
+  //Component that absorbs every speck (-1 if it is dropped)
+  vector<int> dest(NC);
+  int d = (int)(absorbDist*h);
+  int nabs=0;
+  for(int i=0; i<NC; i++) {
+    dest[i] = i;
+    if( !speck[i] )
+      continue;
+
+    component *c = &comps[i];
+    int best=-1, bgap=d+1;
+    for(int gy=max(c->y-d,0)/G; gy<=min(c->t+d,Y-1)/G; gy++)
+      for(int gx=max(c->x-d,0)/G; gx<=min(c->s+d,X-1)/G; gx++)
+	for(int k=gcell[gy*GX+gx]; k<gcell[gy*GX+gx+1]; k++) {
+	  int j = gcomp[k];
+	  if( speck[j] )
+	    continue;
+
+	  //Gap between the speck and the runs of the component
+	  for(int r=comps[j].r0; r<comps[j].r0+comps[j].nr; r++) {
+	    int gap = max(max(cruns[r].x - c->s, c->x - cruns[r].s),
+			  max(cruns[r].y - c->t, c->y - cruns[r].y)) - 1;
+	    gap = max(gap, 0);
+	    if( gap < bgap || (gap == bgap && j < best) ) {
+	      bgap = gap;
+	      best = j;
+	    }
+	  }
+	}
+
+    dest[i] = best;
+    if( best >= 0 )
+      nabs++;
+
+    if( verbose ) {
+      int x=c->x, y=c->y, s=c->s, t=c->t;
+      toImage(&x, &y, &s, &t);
+      if( best >= 0 )
+	printf("Speck (%d,%d)-(%d,%d): %d pixels, absorbed by component %d\n",
+	       x, y, s, t, area[i], best);
+      else
+	printf("Speck (%d,%d)-(%d,%d): %d pixels, dropped\n", x, y, s, t, area[i]);
+    }
+  }
+
+  if( verbose )
+    printf("Specks: %d of %d components (%d absorbed, %d dropped)\n",
+	   nspecks, NC, nabs, nspecks-nabs);
+
+  //Label the runs with their new component and rebuild the sample
+  vector<run> runs;
+  vector<unsigned char> gray;
+  vector<int> label, first(NC);
+  for(int i=0, nr=0; i<NC; i++)
+    if( dest[i] >= 0 ) {
+      first[i] = nr;
+      nr += comps[i].nr;
+    }
+
+  for(int i=0; i<NC; i++) {
+    if( dest[i] < 0 )
+      continue;
+
+    for(int r=comps[i].r0; r<comps[i].r0+comps[i].nr; r++) {
+      run rn = cruns[r];
+      rn.g = gray.size();
+      gray.insert(gray.end(), ink + cruns[r].g, ink + cruns[r].g + rn.s-rn.x+1);
+      runs.push_back(rn);
+      label.push_back(first[dest[i]]);
+    }
+  }
+
+  freeComponents();
+  setComponents(runs, label, gray);
+
+  return nspecks;
+}
+
+int Sample::rp2cmp(int rp) {
+  if( rp < 0 || rp >= NR )
+    return -1;
+
+  return rcomp[rp];
+}
+
+void Sample::getRegion(int *vec, int nComp, int *as, int *cn, int *ds) {
+  getRegion(vec, comps[nComp].x, comps[nComp].y,
+	         comps[nComp].s, comps[nComp].t, nComp);
+
+  baselines(comps[nComp].y, comps[nComp].t, nComp, -1, as, cn, ds);
 }
 
 void Sample::getRegion(int *vec, int nComp, int otroRp,
@@ -168,62 +1055,92 @@ void Sample::getRegion(int *vec, int nComp, int otroRp,
   bbs = max(comps[nComp].s,comps[otrCmp].s);
   bbt = max(comps[nComp].t,comps[otrCmp].t);
 
-  getRegion(vec, bbx, bby, bbs, bbt, comps[nComp].rp, otroRp);
-
-  int n=0, cen=0;
-  float asc=0, des=0;
-  float wasc=0.1, wdes=1.9;
-  float paso=1.8/(bbt-bby);
-
-  for(int y=bby; y<=bbt; y++) {
-    for(int x=bbx; x<=bbs; x++)
-      if( get(x,y)<255 ) {
-	int cc = mfset->find(x,y);
-	if( cc==comps[nComp].rp || cc==otroRp ) {
-	  n++;
-	  asc += y*wasc;
-	  cen += y;
-	  des += y*wdes;
-	}
-      }
-    wasc+=paso;
-    wdes-=paso;
-  }
-
-  *as = asc/n;
-  *cn = cen/n;
-  *ds = des/n;
-}
-
-//Get the (x,y)-(s,t) region normalized to 15x15 and it is stored in 'vec'
-void Sample::getRegion(int *vec, int x, int y, int s, int t, int rp1, int rp2) {
-  //Create a copy of the image
-  Image reg(*img);
-  
-  //Get the region (x,y)-(s,t)
-  reg.chop( Geometry(x,y) );
-  reg.crop( Geometry(s-x+1, t-y+1) );
-  
-  //Remove the pixels of the region that don't belong
-  //to any connected component of rp1 or rp2 from the MFSET
-  Color white(MaxRGB,MaxRGB,MaxRGB);
-  for(int i=y; i<=t; i++)
-    for(int j=x; j<=s; j++) {
-      int rp = mfset->find(j,i);
-      if( rp != rp1 && rp != rp2 )
-	reg.pixelColor(j-x,i-y, white);
+  getRegion(vec, bbx, bby, bbs, bbt, nComp, otrCmp);
+
+  baselines(bby, bbt, nComp, otrCmp, as, cn, ds);
+}
+
+//Ascender, centroid and descender rows of the ink of components c1 and c2
+//(optional) whose bounding box spans rows y..t. The ascender weights the
+//rows linearly from 0.1 (row y) to 1.9 (row t), the descender the other
+//way round, so both are given by the moments of the components
+void Sample::baselines(int y, int t, int c1, int c2, int *as, int *cn, int *ds) {
+  double n = comps[c1].n, sy = comps[c1].sy, syy = comps[c1].syy;
+
+  if( c2 >= 0 ) {
+    n += comps[c2].n;
+    sy += comps[c2].sy;
+    syy += comps[c2].syy;
+  }
+
+  //Sum of ry*(ry-y)*1.8/(t-y) over the ink rows ry
+  double lin = t > y ? 1.8*(syy - y*sy)/(t-y) : 0;
+
+  *as = (int)((0.1*sy + lin)/n);
+  *cn = (int)(sy/n);
+  *ds = (int)((1.9*sy - lin)/n);
+}
+
+//Get the (x,y)-(s,t) region normalized to 15x15 and it is stored in 'vec'.
+//Only the pixels of components c1 and c2 (optional) are kept
+void Sample::getRegion(int *vec, int x, int y, int s, int t, int c1, int c2) {
+  int w = s-x+1, h = t-y+1;
+  unsigned char *reg = new unsigned char[w*h];
+
+  for(int i=0; i<w*h; i++)
+    reg[i] = 255;
+
+  //Copy the runs of the components into the region (x,y)-(s,t)
+  int cc[2] = {c1, c2};
+  for(int c=0; c<2 && cc[c]>=0; c++)
+    for(int r=comps[cc[c]].r0; r<comps[cc[c]].r0+comps[cc[c]].nr; r++)
+      memcpy(&reg[(cruns[r].y-y)*w + cruns[r].x-x], &ink[cruns[r].g],
+	     cruns[r].s-cruns[r].x+1);
+
+  //Scale region to 15x15
+  zoom(reg, w, h, vec);
+
+  delete[] reg;
+}
+
+//Area-averaging scale of the w x h region 'reg' to 15x15 (stored in 'vec').
+//Every output pixel is the mean of the source area it covers, weighting
+//the partially covered source pixels by the fraction of them covered
+void Sample::zoom(unsigned char *reg, int w, int h, int *vec) {
+  float sx = w/15.0, sy = h/15.0;
+  float *rows = new float[h*15];
+
+  //Horizontal pass: w x h -> 15 x h
+  for(int j=0; j<15; j++) {
+    float a=j*sx, b=(j+1)*sx;
+    int ini=(int)a, fin=(int)ceil(b);
+    if( fin > w ) fin = w;
+
+    for(int i=0; i<h; i++) {
+      float sum=0;
+      for(int px=ini; px<fin; px++)
+	sum += (min(b,(float)px+1) - max(a,(float)px)) * reg[i*w + px];
+      rows[i*15 + j] = sum;
     }
-  
-  //Scale image to 15x15
-  reg.zoom( Geometry("15x15!") );
-  
-  //Store result into 'vec'
-  for(int i=0; i<15; i++)
+  }
+
+  //Vertical pass: 15 x h -> 15 x 15
+  for(int i=0; i<15; i++) {
+    float a=i*sy, b=(i+1)*sy;
+    int ini=(int)a, fin=(int)ceil(b);
+    if( fin > h ) fin = h;
+
     for(int j=0; j<15; j++) {
-      Color pc = reg.pixelColor(j,i);
-      vec[i*15+j] = 255*((float)(pc.redQuantum())/MaxRGB);
+      float sum=0;
+      for(int py=ini; py<fin; py++)
+	sum += (min(b,(float)py+1) - max(a,(float)py)) * rows[py*15 + j];
+
+      int v = (int)(sum/(sx*sy) + 0.5);
+      vec[i*15+j] = v > 255 ? 255 : v;
     }
-  
+  }
+
+  delete[] rows;
 }
 
 void Sample::setRegion(CYKcell *c, int nComp) {
@@ -241,6 +1158,9 @@ void Sample::setRegion(CYKcell *c, int nComp, int otroRp) {
   c->t = max(comps[nComp].t, comps[otrCmp].t);
 }
 
+//Components with ink in the bounding box of 'nComp' enlarged by (dx,dy).
+//Their representatives are stored in 'cand' in column-major order of
+//their first pixel inside the region
 int Sample::getCandidates(int nComp, int *cand, int dx, int dy) {
   int rx = comps[nComp].x - dx;
   int ry = comps[nComp].y - dy;
@@ -252,35 +1172,58 @@ int Sample::getCandidates(int nComp, int *cand, int dx, int dy) {
   if( rs > X ) rs=X;
   if( rt > Y ) rt=Y;
 
-  int cind=0;
-  for(int x=rx; x<rs; x++)
-    for(int y=ry; y<rt; y++)
-      if( get(x,y)<255 ) { 
-	int pixr = mfset->find(x,y);
-	if( rp2cmp(pixr)>=0 && pixr != comps[nComp].rp ) {
-	  bool already=false;
-	  for(int i=0; i<cind; i++)
-	    if( cand[i] == pixr ) {
-	      already = true;
-	      break;
-	    }
+  if( rx >= rs || ry >= rt )
+    return 0;
 
-	  if( !already ) {
-	    cand[cind] = pixr;
-	    cind++;
-	  }
+  vector< pair<pair<int,int>,int> > found;
+  stamp++;
+  mark[nComp] = stamp;
+
+  for(int gy=ry/G; gy<=(rt-1)/G; gy++)
+    for(int gx=rx/G; gx<=(rs-1)/G; gx++)
+      for(int i=gcell[gy*GX + gx]; i<gcell[gy*GX + gx + 1]; i++) {
+	int c = gcomp[i];
+	if( mark[c] == stamp )
+	  continue;
+	mark[c] = stamp;
+
+	if( comps[c].x >= rs || comps[c].s < rx
+	    || comps[c].y >= rt || comps[c].t < ry )
+	  continue;
+
+	//First pixel of the component inside the region
+	pair<int,int> key(X,Y);
+	for(int r=comps[c].r0; r<comps[c].r0+comps[c].nr; r++) {
+	  if( cruns[r].y < ry || cruns[r].y >= rt
+	      || cruns[r].x >= rs || cruns[r].s < rx )
+	    continue;
+
+	  pair<int,int> k(max(cruns[r].x, rx), cruns[r].y);
+	  if( k < key )
+	    key = k;
 	}
+
+	if( key.first < X )
+	  found.push_back( make_pair(key, c) );
       }
 
-  return cind;
+  sort(found.begin(), found.end());
+
+  for(int i=0; i<(int)found.size(); i++)
+    cand[i] = comps[found[i].second].rp;
+
+  return found.size();
 }
 
 void Sample::print() {
-  printf("Sample (%d x %d)\n", X, Y);
+  printf("Sample (%d x %d)\n", X0, Y0);
+  if( scale > 1 )
+    printf("Reduced by %d to (%d x %d)\n", scale, X, Y);
   printf("Number of components: %d\n", NC);
 
   for(int i=0; i<NC; i++) {
-    printf("Component %d: (%d,%d)-(%d,%d)\n", i, comps[i].x, comps[i].y,
-	   comps[i].s, comps[i].t);
+    int x=comps[i].x, y=comps[i].y, s=comps[i].s, t=comps[i].t;
+    toImage(&x, &y, &s, &t);
+    printf("Component %d: (%d,%d)-(%d,%d)\n", i, x, y, s, t);
   }
 }
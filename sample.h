@@ -20,8 +20,10 @@
 #define _SAMPLE_
 
 #include <cstdio>
+#include <vector>
 #include <Magick++.h>
 #include "mfset.h"
+#include "binarize.h"
 #include "cyktable.h"
 
 using namespace std;
@@ -29,31 +31,88 @@ using namespace Magick;
 
 //Connected component information
 struct component{
-  int rp; //key in MFSET
+  int rp; //key in MFSET (representative run)
   //Minimum bounding box
   int x, y; //Upper left corner (x,y)
   int s, t; //Bottom right corner   (s,t)
+  //Runs of the component
+  int r0, nr; //First run in Sample::cruns and number of runs
+  //Moments of the rows of the ink: number of pixels, sum of their rows
+  //and sum of their squared rows
+  double n, sy, syy;
+};
+
+//Horizontal run of foreground pixels
+struct run{
+  int y;    //Row
+  int x, s; //First and last column
+  int g;    //Gray levels of its pixels in Sample::ink
+};
+
+
+//Pre-segmented connected component: bounding box and bitmap of
+//(s-x+1)x(t-y+1) pixels, whose rows are 8-bit gray levels (bpp=8) or
+//1-bit pixels with the most significant bit first and 1 as ink (bpp=1)
+struct glyph{
+  int x, y, s, t;
+  int bpp;
+  const unsigned char *pix;
 };
 
 
 class Sample{
-  unsigned char **data;
-  Image *img;
+  static int threads; //Threads used for labeling
   int X, Y;
-  MFSET *mfset;
+  int page; //Page of the file
+  int scale;  //Reduction factor of the resolution
+  int X0, Y0; //Size of the original image
   //Connected components
   component *comps;
   int NC;
+  //Foreground runs
+  int *rcomp;  //Component of every run
+  run *cruns;  //Runs grouped by component
+  int NR;
+  unsigned char *ink; //Gray levels of the runs
+  //Uniform grid over the component bounding boxes
+  int G, GX, GY; //Cell size and grid dimensions
+  int *gcell;    //First entry of every cell in 'gcomp'
+  int *gcomp;    //Components overlapping each cell
+  int *mark, stamp; //Components already visited by a query
+
+  void setPixels(const unsigned char *pix, int stride, int bpp, int refHeight, int bin);
+  void binarizeComponents(const unsigned char *pix, int stride, int bpp, int bin);
+  void labelComponents(const unsigned char *pix, int stride, int bpp,
+		       const unsigned char *gpix=NULL, int gstride=0);
+  void setGlyphs(const glyph *gl, int n);
+  void setComponents(vector<run> &runs, vector<int> &label, vector<unsigned char> &gray);
+  bool loadComponents(char *path);
+  void buildGrid();
+  void freeComponents();
 
-  void getRegion(int *vec, int x, int y, int s, int t, int rp1, int rp2=-1);
+  void getRegion(int *vec, int x, int y, int s, int t, int c1, int c2=-1);
+  void baselines(int y, int t, int c1, int c2, int *as, int *cn, int *ds);
+  void zoom(unsigned char *reg, int w, int h, int *vec);
 
 public:
-  Sample(char *str);
+  Sample(char *str, int refHeight=0, int bin=BIN_NONE);
+  Sample(const unsigned char *buf, int w, int h, int rowBytes, int depth,
+	 int refHeight=0, int bin=BIN_NONE);
+  Sample(const glyph *gl, int n);
+  Sample(Sample *m, const vector<int> &cc);
+  static void loadPages(char *path, vector<Sample *> *pages, int refHeight=0,
+			int bin=BIN_NONE);
   ~Sample();
 
+  static void setThreads(int n);
+
   int dimX();
   int dimY();
   int nComponents();
+  int getPage();
+  void bbox(int *x, int *y, int *s, int *t);
+  void toImage(int *x, int *y, int *s, int *t);
+  int medianHeight();
   unsigned char get(int x, int y);
 
   //One component
@@ -66,7 +125,12 @@ public:
   int getCandidates(int nComp, int *cand, int dx, int dy);
   int rp2cmp(int rp);
 
+  void segment(vector< vector<int> > *regions, float lineGap=1.0, float wordGap=3.0);
+  int despeckle(float minArea=0.5, float minInk=0.25, float maxSize=0.3,
+		float absorbDist=0.15, bool verbose=false);
+
   void print();
+  void saveComponents(char *path);
 };
 
 #endif
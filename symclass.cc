@@ -0,0 +1,149 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include <cstdlib>
+#include "symclass.h"
+
+SymClassifier::SymClassifier() {
+  type = NULL;
+  D = 225; //15x15
+  C = 0;
+}
+
+SymClassifier::~SymClassifier() {
+  delete[] type;
+}
+
+//Key of a class, new classes are numbered in order of appearance
+int SymClassifier::addClass(const char *str) {
+  if( cl2key.find(str) == cl2key.end() ) {
+    cl2key[str] = C;
+    key2cl.push_back(str);
+    C++;
+  }
+  return cl2key[str];
+}
+
+//Read a database of samples: their number and then one line per sample
+//with its class and D values in [0,255]
+void SymClassifier::readSamples(FILE *bd, vector<unsigned char> *raw, vector<int> *lab) {
+  int N=0;
+  if( fscanf(bd, "%d", &N) != 1 || N < 0 ) {
+    fprintf(stderr, "Error reading symbols database\n");
+    exit(-1);
+  }
+  getc(bd);
+
+  raw->resize((size_t)N*D);
+  lab->resize(N);
+
+  for(int i=0; i<N; i++) {
+    char clase[256];
+    if( fscanf(bd, "%255s", clase) != 1 ) {
+      fprintf(stderr, "Error reading sample %d\n", i);
+      exit(-1);
+    }
+    (*lab)[i] = addClass(clase);
+
+    for(int j=0; j<D ; j++) {
+      int v;
+      if( fscanf(bd, "%d", &v) != 1 || v < 0 || v > 255 ) {
+	fprintf(stderr, "Invalid pixel in sample %d\n", i);
+	exit(-1);
+      }
+      (*raw)[(size_t)i*D + j] = v;
+    }
+
+    getc(bd); //Skip the newline character
+  }
+}
+
+//Load information about symbol types of the known classes
+void SymClassifier::loadTypes(FILE *tp) {
+  type = new int[C];
+  for(int c=0; c<C; c++)
+    type[c] = 0;
+
+  char clase[256], T=0, line[256];
+  while( fgets(line, 256, tp) != NULL ) {
+    for(int i=0; line[i] && line[i] != '\n'; i++) {
+      clase[i] = line[i];
+      if( line[i]==' ' ) {
+	clase[i] = 0;
+	T = line[i+1];
+	break;
+      }
+    }
+
+    if( cl2key.find(clase) == cl2key.end() )
+      continue;
+
+    if( T=='n' )       type[ cl2key[clase] ] = 0; //Normal
+    else if( T=='a' )  type[ cl2key[clase] ] = 1; //Ascendant
+    else if( T=='d' )  type[ cl2key[clase] ] = 2; //Descending
+    else {
+      fprintf(stderr, "Error loading symbol types\n");
+      exit(-1);
+    }
+  }
+}
+
+void SymClassifier::classifyBatch(int *vecs, int M, int nbest, int *k, float *p) {
+  for(int m=0; m<M; m++)
+    classify(vecs + (size_t)m*D, nbest, k + (size_t)m*nbest, p + (size_t)m*nbest);
+}
+
+void SymClassifier::setANN(int ef, int M, int efc) {
+}
+
+void SymClassifier::setThreads(int n) {
+}
+
+void SymClassifier::setCache(int size, const char *file) {
+}
+
+void SymClassifier::saveCache() {
+}
+
+void SymClassifier::cacheStats(unsigned long *hits, unsigned long *lookups) {
+  *hits = *lookups = 0;
+}
+
+float SymClassifier::skipped() {
+  return -1;
+}
+
+char *SymClassifier::strClass(int c) {
+  return (char *)(key2cl[c]).c_str();
+}
+
+int SymClassifier::keyClass(char *str) {
+  if( cl2key.find(str) == cl2key.end() ) {
+    fprintf(stderr, "Warning: Class '%s' doesn't appear in symbols database\n", str);
+    return -1;
+  }
+  return cl2key[str];
+}
+
+int SymClassifier::getNClasses() {
+  return C;
+}
+
+int SymClassifier::symType(int k) {
+  return type[k];
+}
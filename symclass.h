@@ -0,0 +1,77 @@
+/*
+* Copyright (C) 2011 Francisco Álvaro <falvaro@dsic.upv.es>.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#ifndef _SYMCLASS_
+#define _SYMCLASS_
+
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+//Posterior probability aproximation from the distance of a vector to the
+//nearest sample of a class, the scale of the probabilities of all the
+//classifiers
+#define DIST_SCALE 3500000.0f
+
+static inline float distPosterior(float d) {
+  return exp(-(double)d/DIST_SCALE);
+}
+
+//Symbol classifier of the grammar. The n-best list of a vector of D
+//values (15x15 gray levels) has the classes k[0..nbest) with their
+//posterior probabilities p[0..nbest) in increasing order, the best one
+//last. Missing entries have class -1 and probability 0
+class SymClassifier{
+ protected:
+  int *type; //Symbol type of every class
+  map<string,int> cl2key;
+  vector<string> key2cl;
+
+  int D; //Sample's dimensions
+  int C; //Number of classes
+
+  int addClass(const char *str);
+  void readSamples(FILE *bd, vector<unsigned char> *raw, vector<int> *lab);
+  void loadTypes(FILE *tp);
+
+ public:
+  SymClassifier();
+  virtual ~SymClassifier();
+
+  virtual void classify(int *vec, int nbest, int *k, float *p) = 0;
+  virtual void classifyBatch(int *vecs, int M, int nbest, int *k, float *p);
+
+  //Options of the nearest neighbour search, ignored by other classifiers
+  virtual void setANN(int ef, int M=16, int efc=100);
+  virtual void setThreads(int n);
+  virtual void setCache(int size, const char *file=NULL);
+  virtual void saveCache();
+  virtual void cacheStats(unsigned long *hits, unsigned long *lookups);
+  virtual float skipped();
+
+  char *strClass(int c);
+  int keyClass(char *str);
+  int getNClasses();
+  int symType(int k);
+};
+
+#endif